@@ -0,0 +1,68 @@
+#ifndef C3TRAJECTORY_C3FLIGHTRECORDER_H
+#define C3TRAJECTORY_C3FLIGHTRECORDER_H
+
+#include <stdint.h>
+#include <string>
+
+#include "C3Trajectory.h"
+
+namespace subjugator
+{
+// On-disk layout of a flight log, shared by C3FlightRecorder and c3_flight_log_to_csv. The file is a header followed
+// by a ring of capacity records; record n lives in slot n % capacity and count is the number of records ever written.
+struct C3FlightLogHeader
+{
+  char magic[8];
+  uint32_t version;
+  uint32_t record_size;
+  uint64_t capacity;
+  uint64_t count;
+};
+
+// One C3 integration step. Everything but t, waypoint_t and the waypoint is the state after the step; the limits are
+// the ones control() applied during it.
+struct C3FlightRecord
+{
+  // Equal to the record's index, written last so a reader can tell a complete record from a partly overwritten one
+  uint64_t seq;
+  double t;
+  double waypoint_t;
+  double r[6];
+  double rdot[6];
+  double q[6];
+  double qdot[6];
+  double qdotdot_b[6];
+  double u_b[6];
+  double vmin_b[6];
+  double vmax_b[6];
+  double amin_b[6];
+  double amax_b[6];
+};
+
+static const char C3_FLIGHT_LOG_MAGIC[8] = { 'C', '3', 'F', 'L', 'I', 'G', 'H', 'T' };
+static const uint32_t C3_FLIGHT_LOG_VERSION = 1;
+
+// Records every C3 step into a memory mapped ring file. Recording a step is a copy into the mapping, the kernel
+// writes the pages back on its own, so the file survives the process crashing.
+class C3FlightRecorder
+{
+public:
+  // Creates or truncates path to hold capacity records and maps it. Throws std::runtime_error on failure.
+  C3FlightRecorder(const std::string &path, uint64_t capacity);
+  ~C3FlightRecorder();
+
+  void record(double t, const C3Trajectory &trajectory, const C3Trajectory::Waypoint &waypoint, double waypoint_t);
+
+private:
+  C3FlightRecorder(const C3FlightRecorder &);
+  C3FlightRecorder &operator=(const C3FlightRecorder &);
+
+  int fd_;
+  size_t size_;
+  C3FlightLogHeader *header_;
+  C3FlightRecord *records_;
+  uint64_t count_;
+};
+};
+
+#endif
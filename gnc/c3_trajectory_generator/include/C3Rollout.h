@@ -0,0 +1,58 @@
+#ifndef C3TRAJECTORY_C3ROLLOUT_H
+#define C3TRAJECTORY_C3ROLLOUT_H
+
+#include <deque>
+#include <vector>
+
+#include "C3Trajectory.h"
+
+namespace subjugator
+{
+// Runs a private copy of a C3Trajectory forward in simulated time until it arrives at a waypoint,
+// keeping a decimated copy of the path. The sample buffers are reused between runs.
+class C3Rollout
+{
+public:
+  C3Rollout(double dt, bool exact_integration, size_t reserved_samples = 0);
+
+  // Returns true if the trajectory got within tolerance of the waypoint before max_time
+  bool run(const C3Trajectory &start, const C3Trajectory::Waypoint &waypoint, double linear_tolerance,
+           double angular_tolerance, double sample_period, double max_time);
+
+  // Same, through a moveto_sequence: waypoint, then each of queue in turn, handing over where the trajectory thread
+  // would (C3Trajectory::should_blend). Returns true if it got within tolerance of the last one before max_time.
+  bool run(const C3Trajectory &start, const C3Trajectory::Waypoint &waypoint,
+           const std::deque<C3Trajectory::Waypoint> &queue, double blend_radius, double linear_tolerance,
+           double angular_tolerance, double sample_period, double max_time);
+
+  const std::vector<C3Trajectory::PointWithAcceleration> &samples() const
+  {
+    return samples_;
+  }
+  const std::vector<double> &sample_times() const
+  {
+    return sample_times_;
+  }
+  double time_to_arrival() const
+  {
+    return time_to_arrival_;
+  }
+  // Per waypoint of the queue, the index of the sample at which it was handed over to. The samples between
+  // consecutive handovers are one leg of the sequence.
+  const std::vector<size_t> &handovers() const
+  {
+    return handovers_;
+  }
+
+private:
+  double dt_;
+  bool exact_integration_;
+
+  std::vector<C3Trajectory::PointWithAcceleration> samples_;
+  std::vector<double> sample_times_;
+  std::vector<size_t> handovers_;
+  double time_to_arrival_;
+};
+};
+
+#endif
@@ -0,0 +1,65 @@
+#ifndef C3TRAJECTORY_C3ROLLOUTPOOL_H
+#define C3TRAJECTORY_C3ROLLOUTPOOL_H
+
+#include <vector>
+
+#include <boost/function.hpp>
+#include <boost/ptr_container/ptr_vector.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "C3Rollout.h"
+
+namespace subjugator
+{
+// A fixed set of worker threads, each with its own C3Rollout, that roll out a batch of candidate waypoints from a
+// common start in parallel.
+class C3RolloutPool
+{
+public:
+  struct Result
+  {
+    bool arrived;
+    double time_to_arrival;
+    bool path_valid;
+  };
+
+  // Called on a worker thread with each finished rollout, must be safe to call concurrently
+  typedef boost::function<bool(const C3Rollout &)> PathCheck;
+
+  C3RolloutPool(size_t threads, double dt, bool exact_integration);
+  ~C3RolloutPool();
+
+  // Blocks until every waypoint has been rolled out. Not reentrant, batches must be run one at a time.
+  void run(const C3Trajectory &start, const std::vector<C3Trajectory::Waypoint> &waypoints, double linear_tolerance,
+           double angular_tolerance, double max_time, const PathCheck &path_check, std::vector<Result> &results);
+
+private:
+  void worker(size_t index);
+
+  boost::ptr_vector<C3Rollout> rollouts_;
+  boost::thread_group threads_;
+
+  boost::mutex mutex_;
+  boost::condition_variable work_cv_;
+  boost::condition_variable done_cv_;
+  bool shutdown_;
+
+  // The batch being worked on, only changed under mutex_. The pointers are only set while a batch is running, and its
+  // size is kept here because the caller's vectors may change as soon as run() returns.
+  unsigned int batch_;
+  size_t size_;
+  size_t next_;
+  size_t remaining_;
+  const C3Trajectory *start_;
+  const std::vector<C3Trajectory::Waypoint> *waypoints_;
+  double linear_tolerance_;
+  double angular_tolerance_;
+  double max_time_;
+  const PathCheck *path_check_;
+  std::vector<Result> *results_;
+};
+};
+
+#endif
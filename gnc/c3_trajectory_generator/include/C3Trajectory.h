@@ -2,49 +2,115 @@
 #define C3TRAJECTORY_C3FILTER_H
 
 #include <Eigen/Dense>
+#include <cmath>
 
 namespace subjugator
 {
 typedef Eigen::Matrix<double, 6, 1> Vector6d;
+typedef Eigen::Array<double, 6, 1> Array6d;
 
-class C3Trajectory
+// Layout of q for each supported DOF count: how many of its leading entries are position in the fixed frame, and
+// the rotation from body to fixed frame given by the trailing Euler angles.
+template <typename Scalar, int DOF>
+struct C3Frame;
+
+// q = (x, y, z, roll, pitch, yaw)
+template <typename Scalar>
+struct C3Frame<Scalar, 6>
+{
+  enum
+  {
+    LINEAR = 3
+  };
+  typedef Eigen::Matrix<Scalar, 3, 3> Rotation;
+
+  static Rotation rotation(const Eigen::Matrix<Scalar, 6, 1> &q)
+  {
+    Scalar sphi = std::sin(q(3)), cphi = std::cos(q(3));
+    Scalar stheta = std::sin(q(4)), ctheta = std::cos(q(4));
+    Scalar spsi = std::sin(q(5)), cpsi = std::cos(q(5));
+
+    Rotation R;
+    R << cpsi * ctheta, -spsi * cphi + cpsi * stheta * sphi, spsi * sphi + cpsi * cphi * stheta,  //
+        spsi * ctheta, cpsi * cphi + sphi * stheta * spsi, -cpsi * sphi + stheta * spsi * cphi,   //
+        -stheta, ctheta * sphi, ctheta * cphi;
+    return R;
+  }
+};
+
+// q = (x, y, yaw), for surface vehicles
+template <typename Scalar>
+struct C3Frame<Scalar, 3>
+{
+  enum
+  {
+    LINEAR = 2
+  };
+  typedef Eigen::Matrix<Scalar, 2, 2> Rotation;
+
+  static Rotation rotation(const Eigen::Matrix<Scalar, 3, 1> &q)
+  {
+    Scalar spsi = std::sin(q(2)), cpsi = std::cos(q(2));
+
+    Rotation R;
+    R << cpsi, -spsi, spsi, cpsi;
+    return R;
+  }
+};
+
+// C3 trajectory over DOF axes in Scalar precision. Use the C3Trajectory typedef for the sub itself,
+// C3Trajectoryf for bulk rollouts where float precision is enough, and SurfaceC3Trajectory for surface vehicles.
+template <typename Scalar, int DOF>
+class BasicC3Trajectory
 {
 public:
+  EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+
+  enum
+  {
+    LINEAR = C3Frame<Scalar, DOF>::LINEAR,
+    ANGULAR = DOF - LINEAR
+  };
+  typedef Eigen::Matrix<Scalar, DOF, 1> Vector;
+  typedef Eigen::Array<Scalar, DOF, 1> Array;
+  typedef Eigen::Matrix<Scalar, LINEAR, 1> LinearVector;
+  typedef typename C3Frame<Scalar, DOF>::Rotation Rotation;
+
   struct Limits
   {
-    Vector6d vmin_b;
-    Vector6d vmax_b;
-    Vector6d amin_b;
-    Vector6d amax_b;
-    Eigen::Vector3d arevoffset_b;
-    Vector6d umax_b;
+    Vector vmin_b;
+    Vector vmax_b;
+    Vector amin_b;
+    Vector amax_b;
+    LinearVector arevoffset_b;
+    Vector umax_b;
   };
 
   struct Point
   {
-    Vector6d q;
-    Vector6d qdot;
+    Vector q;
+    Vector qdot;
 
     Point()
     {
     }
 
-    Point(const Vector6d &q, const Vector6d &qdot) : q(q), qdot(qdot)
+    Point(const Vector &q, const Vector &qdot) : q(q), qdot(qdot)
     {
     }
 
-    bool is_approximately(const Point &other, double linear_tolerance, double angular_tolerance)
+    bool is_approximately(const Point &other, Scalar linear_tolerance, Scalar angular_tolerance) const
     {
-      Vector6d q_difference = q - other.q;
-      return q_difference.segment<3>(0).norm() < linear_tolerance &&
-             q_difference.segment<3>(3).norm() < angular_tolerance;
+      Vector q_difference = q - other.q;
+      return q_difference.template head<LINEAR>().norm() < linear_tolerance &&
+             q_difference.template tail<ANGULAR>().norm() < angular_tolerance;
     }
   };
 
   struct PointWithAcceleration : public Point
   {
-    Vector6d qdotdot;
-    PointWithAcceleration(const Vector6d &q, const Vector6d &qdot, const Vector6d &qdotdot)
+    Vector qdotdot;
+    PointWithAcceleration(const Vector &q, const Vector &qdot, const Vector &qdotdot)
       : Point(q, qdot), qdotdot(qdotdot)
     {
     }
@@ -53,41 +119,107 @@ public:
   struct Waypoint
   {
     Point r;
-    double speed;
+    Scalar speed;
     bool coordinate_unaligned;
     bool do_waypoint_validation;
 
     Waypoint()
     {
     }
-    Waypoint(const Point &r, double speed = 0, bool coordinate_unaligned = true, bool do_waypoint_validation = true)
+    Waypoint(const Point &r, Scalar speed = 0, bool coordinate_unaligned = true, bool do_waypoint_validation = true)
       : r(r), speed(speed), coordinate_unaligned(coordinate_unaligned), do_waypoint_validation(do_waypoint_validation)
     {
     }
   };
 
-  C3Trajectory(const Point &start, const Limits &limits);
-  void update(double dt, const Waypoint &waypoint, double waypoint_t);
+  // Limits control() actually applied in the last step, after speed, coordination and reversal adjustments
+  struct StepLimits
+  {
+    Vector vmin_b;
+    Vector vmax_b;
+    Vector amin_b;
+    Vector amax_b;
+  };
+
+  BasicC3Trajectory(const Point &start, const Limits &limits);
+  void update(Scalar dt, const Waypoint &waypoint, Scalar waypoint_t);
+
+  // Same as update, but integrates the piecewise-constant jerk exactly instead of with semi-implicit
+  // Euler, so it stays accurate at much larger dt.
+  void update_exact(Scalar dt, const Waypoint &waypoint, Scalar waypoint_t);
 
   PointWithAcceleration getCurrentPoint() const;
 
+  // Internal state of the last step, for logging
+  const Vector &getBodyAcceleration() const
+  {
+    return qdotdot_b;
+  }
+  const Vector &getBodyJerk() const
+  {
+    return u_b;
+  }
+  const StepLimits &getStepLimits() const
+  {
+    return step_limits;
+  }
+
+  // True once the trajectory should hand over from waypoint to the next one in a sequence: its position is
+  // within blend_radius of the waypoint, or within the distance it needs to brake to a stop (along the direction to
+  // the waypoint), whichever is larger, and its orientation is within angular_tolerance of the waypoint's.
+  // Switching there keeps the sub moving instead of decelerating to zero at every intermediate waypoint, without
+  // skipping waypoints that only rotate.
+  bool should_blend(const Waypoint &waypoint, Scalar blend_radius, Scalar angular_tolerance) const;
+
   bool do_waypoint_validation;
 
+  // Run the per-axis scalar c3filter instead of the vectorized kernel. Kept as a reference for
+  // benchmarking and for checking the vectorized kernel against. The kernel is the default because it takes a little
+  // over half the time per call (c3_trajectory_benchmark's "filter" lines). A whole update is dominated by the rest of
+  // the step, so there the difference is within run-to-run noise.
+  bool use_scalar_filter;
+
+  static Scalar c3filter(Scalar q, Scalar qdot, Scalar qdotdot, Scalar r, Scalar rdot, Scalar rdotdot, Scalar vmin,
+                         Scalar vmax, Scalar amin, Scalar amax, Scalar umax);
+
+  // Evaluates c3filter for all axes at once with branchless sign/select and no pow(). Not bit-identical: S is
+  // computed with x * x * x where c3filter has pow(x, 3), so it can differ by a few ulp of its largest term. The jerk
+  // is -umax, 0 or umax either way, and only differs on an axis whose S is within that distance of a switching
+  // surface (test_c3_trajectory.cpp checks a bound of 8 ulp).
+  static Array c3filter_vectorized(const Array &q, const Array &qdot, const Array &qdotdot, const Array &r,
+                                   const Array &rdot, const Array &rdotdot, const Array &vmin, const Array &vmax,
+                                   const Array &amin, const Array &amax, const Array &umax);
+
 private:
-  Vector6d q;
-  Vector6d qdot;
-  Vector6d qdotdot_b;
-  Vector6d u_b;
+  Vector q;
+  Vector qdot;
+  Vector qdotdot_b;
+  Vector u_b;
+  StepLimits step_limits;
+
+  // Body to fixed frame rotation at q, recomputed once per step so the trig is only evaluated once
+  Rotation R;
 
   Limits limits;
 
-  static double c3filter(double q, double qdot, double qdotdot, double r, double rdot, double rdotdot, double vmin,
-                         double vmax, double amin, double amax, double umax);
+  Vector control(const Waypoint &waypoint, Scalar waypoint_t, StepLimits &applied) const;
+  void wrap_angles();
+
+  // Body frame coordinates of a fixed frame position (relative to q) or of a fixed frame derivative, and back
+  Vector to_body(const Vector &x, bool position) const;
+  Vector from_body(const Vector &x_b) const;
 
-  static std::pair<Eigen::Matrix4d, Eigen::Matrix4d> transformation_pair(const Vector6d &q);
-  static std::pair<Eigen::Vector3d, Eigen::Vector3d> limit(const Eigen::Vector3d &vmin, const Eigen::Vector3d &vmax,
-                                                           const Eigen::Vector3d &delta);
+  static std::pair<LinearVector, LinearVector> limit(const LinearVector &vmin, const LinearVector &vmax,
+                                                     const LinearVector &delta);
 };
+
+typedef BasicC3Trajectory<double, 6> C3Trajectory;
+typedef BasicC3Trajectory<float, 6> C3Trajectoryf;
+typedef BasicC3Trajectory<double, 3> SurfaceC3Trajectory;
+
+extern template class BasicC3Trajectory<double, 6>;
+extern template class BasicC3Trajectory<float, 6>;
+extern template class BasicC3Trajectory<double, 3>;
 };
 
 #endif
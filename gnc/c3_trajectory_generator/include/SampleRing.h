@@ -0,0 +1,56 @@
+#ifndef C3TRAJECTORY_SAMPLERING_H
+#define C3TRAJECTORY_SAMPLERING_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+namespace subjugator
+{
+// Lock-free log of samples from one producer thread to one consumer thread. Unlike TripleBuffer every sample is
+// kept, as long as the consumer drains the ring before the producer gets Capacity samples ahead of it. The producer
+// never waits; samples it overwrites before they are drained are counted as dropped.
+template <typename T, size_t Capacity>
+class SampleRing
+{
+public:
+  SampleRing() : written_(0), read_(0)
+  {
+  }
+
+  void push(const T &sample)
+  {
+    size_t n = written_.load(std::memory_order_relaxed);
+    slots_[n % Capacity] = sample;
+    written_.store(n + 1, std::memory_order_release);
+  }
+
+  // Appends every sample pushed since the last call to out and returns how many were dropped
+  size_t drain(std::vector<T> &out)
+  {
+    size_t end = written_.load(std::memory_order_acquire);
+    size_t begin = end - read_ > Capacity ? end - Capacity : read_;
+    size_t old_size = out.size();
+    for (size_t i = begin; i < end; ++i)
+      out.push_back(slots_[i % Capacity]);
+
+    // Anything the producer lapped while we were copying may be torn, throw it away
+    size_t lapped = written_.load(std::memory_order_acquire);
+    size_t valid_begin = lapped - begin > Capacity ? lapped - Capacity : begin;
+    if (valid_begin > begin)
+      out.erase(out.begin() + old_size, out.begin() + old_size + std::min(valid_begin, end) - begin);
+
+    size_t dropped = std::min(valid_begin, end) - read_;
+    read_ = end;
+    return dropped;
+  }
+
+private:
+  T slots_[Capacity];
+  std::atomic<size_t> written_;
+  size_t read_;
+};
+};
+
+#endif
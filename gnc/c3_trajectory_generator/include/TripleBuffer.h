@@ -0,0 +1,57 @@
+#ifndef C3TRAJECTORY_TRIPLEBUFFER_H
+#define C3TRAJECTORY_TRIPLEBUFFER_H
+
+#include <atomic>
+
+namespace subjugator
+{
+// Lock-free hand-over of the latest value from one producer thread to one consumer thread. The producer fills
+// back() and publish()es it; the consumer calls update() and reads front(). Neither side ever waits on the other,
+// and values that are overwritten before the consumer gets to them are dropped.
+//
+// This is a double buffer (front for the consumer, back for the producer) with a third, middle slot that the two
+// sides swap their slot with atomically, so neither can ever be writing the slot the other is reading.
+template <typename T>
+class TripleBuffer
+{
+public:
+  TripleBuffer() : front_(0), middle_(1), back_(2)
+  {
+  }
+
+  T &back()
+  {
+    return slots_[back_];
+  }
+
+  void publish()
+  {
+    back_ = middle_.exchange(back_ | DIRTY) & INDEX;
+  }
+
+  // Returns true if a value was published since the last call, in which case it is now in front()
+  bool update()
+  {
+    if (!(middle_.load() & DIRTY))
+      return false;
+    front_ = middle_.exchange(front_) & INDEX;
+    return true;
+  }
+
+  T &front()
+  {
+    return slots_[front_];
+  }
+
+private:
+  static const int INDEX = 3;
+  static const int DIRTY = 4;
+
+  T slots_[3];
+  int front_;
+  std::atomic<int> middle_;
+  int back_;
+};
+};
+
+#endif
@@ -0,0 +1,183 @@
+#ifndef C3TRAJECTORY_VOXELMAP_H
+#define C3TRAJECTORY_VOXELMAP_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace subjugator
+{
+// Sparse 3D occupancy: hit counts of the voxels that have been hit, in an open addressing hash table keyed by voxel
+// index. Memory scales with the number of hit voxels (about 10 bytes each, up to twice that right after the table
+// grows) instead of the volume they span, so a pool's walls and obstacles at 0.1 m take a few MB.
+// Voxel (i, j, k) spans [i, i + 1) * resolution in x, and likewise for j in y and k in z.
+class VoxelMap
+{
+public:
+  // Indices are kept in 21 bits each, +-104 km at 0.1 m
+  static const int INDEX_BITS = 21;
+
+  explicit VoxelMap(double resolution = 0.2) : resolution_(resolution), size_(0), shift_(64)
+  {
+  }
+
+  double resolution() const
+  {
+    return resolution_;
+  }
+
+  // Number of voxels that have been hit at least once
+  size_t size() const
+  {
+    return size_;
+  }
+
+  size_t memory_bytes() const
+  {
+    return keys_.capacity() * sizeof(uint64_t) + hits_.capacity() * sizeof(uint16_t);
+  }
+
+  void clear()
+  {
+    keys_.clear();
+    hits_.clear();
+    size_ = 0;
+  }
+
+  int index(double x) const
+  {
+    return std::floor(x / resolution_);
+  }
+
+  // Count a hit in the voxel containing (x, y, z), returns its hits after. Hit counts saturate instead of wrapping.
+  uint16_t add(double x, double y, double z)
+  {
+    return add_voxel(index(x), index(y), index(z));
+  }
+
+  uint16_t add_voxel(int i, int j, int k, uint16_t count = 1)
+  {
+    if ((size_ + 1) * 4 > keys_.size() * 3)
+      grow();
+    size_t slot = find(pack(i, j, k));
+    if (keys_[slot] == EMPTY)
+    {
+      keys_[slot] = pack(i, j, k);
+      ++size_;
+    }
+    hits_[slot] = std::min<uint32_t>(hits_[slot] + count, UINT16_MAX);
+    return hits_[slot];
+  }
+
+  uint16_t hits(int i, int j, int k) const
+  {
+    if (size_ == 0)
+      return 0;
+    size_t slot = find(pack(i, j, k));
+    return keys_[slot] == EMPTY ? 0 : hits_[slot];
+  }
+
+  // Usage: Count the voxels with at least min_hits hits in the box from (x0, y0, z0) to (x1, y1, z1), in meters.
+  // Probes each voxel of the box or scans the table, whichever is fewer lookups, so large boxes stay cheap.
+  size_t count_in_box(double x0, double y0, double z0, double x1, double y1, double z1, uint16_t min_hits = 1) const
+  {
+    int i0 = index(x0), j0 = index(y0), k0 = index(z0);
+    int i1 = index(x1), j1 = index(y1), k1 = index(z1);
+    if (size_ == 0 || i1 < i0 || j1 < j0 || k1 < k0)
+      return 0;
+
+    size_t count = 0;
+    double volume = double(i1 - i0 + 1) * (j1 - j0 + 1) * (k1 - k0 + 1);
+    if (volume <= keys_.size())
+    {
+      for (int i = i0; i <= i1; ++i)
+        for (int j = j0; j <= j1; ++j)
+          for (int k = k0; k <= k1; ++k)
+            count += hits(i, j, k) >= min_hits;
+      return count;
+    }
+
+    for (size_t slot = 0; slot < keys_.size(); ++slot)
+    {
+      if (keys_[slot] == EMPTY || hits_[slot] < min_hits)
+        continue;
+      int i, j, k;
+      unpack(keys_[slot], i, j, k);
+      count += i >= i0 && i <= i1 && j >= j0 && j <= j1 && k >= k0 && k <= k1;
+    }
+    return count;
+  }
+
+  // Usage: Call f(i, j, k, hits) for every voxel that has been hit, in no particular order
+  template <typename F>
+  void for_each(F f) const
+  {
+    for (size_t slot = 0; slot < keys_.size(); ++slot)
+    {
+      if (keys_[slot] == EMPTY)
+        continue;
+      int i, j, k;
+      unpack(keys_[slot], i, j, k);
+      f(i, j, k, hits_[slot]);
+    }
+  }
+
+private:
+  static const uint64_t EMPTY = ~uint64_t(0);
+  static const uint64_t INDEX_MASK = (uint64_t(1) << INDEX_BITS) - 1;
+  static const int INDEX_OFFSET = 1 << (INDEX_BITS - 1);
+
+  double resolution_;
+  size_t size_;
+  // 64 - log2(keys_.size())
+  int shift_;
+  // Parallel arrays, a power of two long; keys_[slot] == EMPTY marks a free slot
+  std::vector<uint64_t> keys_;
+  std::vector<uint16_t> hits_;
+
+  static uint64_t pack(int i, int j, int k)
+  {
+    return (uint64_t((i + INDEX_OFFSET) & INDEX_MASK) << (2 * INDEX_BITS)) |
+           (uint64_t((j + INDEX_OFFSET) & INDEX_MASK) << INDEX_BITS) | uint64_t((k + INDEX_OFFSET) & INDEX_MASK);
+  }
+
+  static void unpack(uint64_t key, int &i, int &j, int &k)
+  {
+    i = int((key >> (2 * INDEX_BITS)) & INDEX_MASK) - INDEX_OFFSET;
+    j = int((key >> INDEX_BITS) & INDEX_MASK) - INDEX_OFFSET;
+    k = int(key & INDEX_MASK) - INDEX_OFFSET;
+  }
+
+  // Slot holding key, or the free slot where it belongs. Linear probing from a Fibonacci hash, which takes the
+  // slot from the top bits of the product so every index bit affects it.
+  size_t find(uint64_t key) const
+  {
+    size_t mask = keys_.size() - 1;
+    size_t slot = (key * 0x9E3779B97F4A7C15ull) >> shift_;
+    while (keys_[slot] != EMPTY && keys_[slot] != key)
+      slot = (slot + 1) & mask;
+    return slot;
+  }
+
+  void grow()
+  {
+    const uint64_t empty = EMPTY;
+    std::vector<uint64_t> keys(std::max<size_t>(64, 2 * keys_.size()), empty);
+    std::vector<uint16_t> hits(keys.size(), 0);
+    keys.swap(keys_);
+    hits.swap(hits_);
+    shift_ = 64 - __builtin_ctzll(keys_.size());
+    for (size_t slot = 0; slot < keys.size(); ++slot)
+    {
+      if (keys[slot] == EMPTY)
+        continue;
+      size_t to = find(keys[slot]);
+      keys_[to] = keys[slot];
+      hits_[to] = hits[slot];
+    }
+  }
+};
+};
+
+#endif
@@ -1,10 +1,15 @@
 #pragma once
+#include <c3_trajectory_generator/OccupiedVoxels.h>
+#include <c3_trajectory_generator/OgridUpdate.h>
 #include <geometry_msgs/PoseStamped.h>
 #include <nav_msgs/OccupancyGrid.h>
 #include <ros/ros.h>
 
+#include <boost/shared_ptr.hpp>
 #include <opencv2/core/core.hpp>
 
+#include "VoxelMap.h"
+
 enum class WAYPOINT_ERROR_TYPE
 {
   OCCUPIED = 99,
@@ -24,19 +29,85 @@ enum class OGRID_COLOR
   GREEN = 120
 };
 
+// Summed-area tables of an ogrid, built once per received ogrid so that any axis aligned rectangle of it can be
+// checked in constant time, and patched with the ogrid's updates. Only patched while no other thread holds them,
+// so once shared they can be read from any thread.
+struct OgridTables
+{
+  struct Counts
+  {
+    int occupied;
+    int unknown;
+    // Cells of the rectangle that lie outside the ogrid
+    int outside;
+  };
+
+  OgridTables(const nav_msgs::OccupancyGridConstPtr &ogrid);
+  // Deep copy, the tables aren't shared with other
+  OgridTables(const OgridTables &other);
+
+  // Usage: Apply an update that fits the ogrid. Only the rows from the update's first one down are recomputed.
+  void patch(const c3_trajectory_generator::OgridUpdate &update);
+
+  // Usage: Count the cells in [x0, x1) x [y0, y1), clamping the rectangle to the ogrid
+  Counts count(int x0, int y0, int x1, int y1) const;
+
+  // Usage: Is any cell in [x0, x1) x [y0, y1) occupied? Cells outside of the ogrid count as occupied
+  bool is_occupied(int x0, int y0, int x1, int y1) const;
+
+  // The keyframe the tables were built from. Its info still applies, but its cells may have been patched since.
+  nav_msgs::OccupancyGridConstPtr ogrid;
+  // Of the keyframe or of the last update applied
+  ros::Time stamp;
+  // CV_32S, one row and column larger than the ogrid: occupied(y, x) is the number of occupied cells in [0, x) x [0, y)
+  cv::Mat occupied;
+  cv::Mat unknown;
+
+private:
+  OgridTables &operator=(const OgridTables &);
+  // Recompute table from row y down, with the cells in [x, x + width) x [y, y + height) taken from data
+  static void patch_table(cv::Mat &table, int8_t value, int x, int y, int width, int height, const int8_t *data);
+};
+
 class WaypointValidity
 {
 private:
   ros::NodeHandle *nh_;
-  nav_msgs::OccupancyGridConstPtr ogrid_map_;
+  boost::shared_ptr<const OgridTables> ogrid_;
+  // Only touched by the thread receiving ogrids. current_ is what ogrid_ points to. spare_ is the tables before the
+  // last update (spare_missing_), patched and reused for the next update once no other thread holds them any more,
+  // so an update costs the rows below it rather than copying the tables.
+  boost::shared_ptr<OgridTables> current_;
+  boost::shared_ptr<OgridTables> spare_;
+  c3_trajectory_generator::OgridUpdateConstPtr spare_missing_;
   ros::Subscriber sub_;
+  ros::Subscriber update_sub_;
+  // Occupied voxels, used instead of the ogrid's occupied cells for waypoint checks when use_voxels_ is set
+  boost::shared_ptr<const subjugator::VoxelMap> voxels_;
+  ros::Subscriber voxel_sub_;
+  bool use_voxels_;
 
   ros::Publisher pub_sub_ogrid_;
   ros::Publisher pub_waypoint_ogrid_;
   double sub_ogrid_size_;
+  double sub_height_;
 
   // Usage: Given a size and point, relative to ogrid, will check if there is an occupied grid
-  bool check_if_hit(cv::Point center, cv::Size sub_size);
+  static bool check_if_hit(const OgridTables &ogrid, cv::Point center, cv::Size sub_size);
+
+  // Usage: Check the cells of a footprint's leading edge after its center moved one cell by (dx, dy)
+  static bool check_if_hit_edge(const OgridTables &ogrid, cv::Point center, cv::Size sub_size, int dx, int dy);
+
+  // Usage: Same edge as check_if_hit_edge, but only whether any of it lies outside the ogrid
+  static bool edge_leaves_ogrid(const OgridTables &ogrid, cv::Point center, cv::Size sub_size, int dx, int dy);
+
+  // Usage: Half extents in x and y of the axis aligned bounding box of a length x width footprint turned by pose's yaw
+  static void footprint_half_extents(const geometry_msgs::Pose &pose, double length, double width, double &half_x,
+                                     double &half_y);
+
+  // Usage: Count the occupied voxels in a length x width x height box centered on pose
+  static size_t count_footprint_voxels(const subjugator::VoxelMap &voxels, const geometry_msgs::Pose &pose,
+                                       double length, double width, double height);
 
 public:
   WaypointValidity(ros::NodeHandle &nh);
@@ -44,9 +115,31 @@ public:
   // Usage: Store the reference to the previous ogrid in publisher
   void ogrid_callback(const nav_msgs::OccupancyGridConstPtr &ogrid_map);
 
+  // Usage: Patch the last ogrid with the cells that changed since. Updates to another ogrid, or that aren't newer than
+  // the last ogrid or update, are dropped. Must be called on the same thread as ogrid_callback
+  void ogrid_update_callback(const c3_trajectory_generator::OgridUpdateConstPtr &update);
+
+  void voxels_callback(const c3_trajectory_generator::OccupiedVoxelsConstPtr &msg);
+
   void pub_size_ogrid(const geometry_msgs::Pose &waypoint, int d = 0);
 
   // Usage: Given a waypoint or trajectory, check what it will hit on the ogrid.
   std::pair<bool, WAYPOINT_ERROR_TYPE> is_waypoint_valid(const geometry_msgs::Pose &waypoint,
                                                          bool do_waypoint_validation);
+
+  // Usage: Count what lies under a length x width (in meters) footprint centered on pose and turned by its yaw.
+  // Turned footprints are counted over their axis aligned bounding box, so they err on the side of occupied.
+  // Returns false if no ogrid has been received yet.
+  bool get_footprint_counts(const geometry_msgs::Pose &pose, double length, double width, OgridTables::Counts &counts);
+
+  // Usage: Count the occupied voxels in a length x width x height (in meters) box centered on pose and turned by its
+  // yaw, over its axis aligned bounding box like get_footprint_counts. Returns false if no voxels have been received.
+  bool get_footprint_voxels(const geometry_msgs::Pose &pose, double length, double width, double height,
+                            size_t &occupied);
+
+  // Usage: Given the sampled path of a trajectory, check if the sub's footprint sweeps over anything occupied, using
+  // the voxels at the path's depth instead of the ogrid's occupied cells when use_voxels is set.
+  // Safe to call from other threads than the one receiving ogrids.
+  std::pair<bool, WAYPOINT_ERROR_TYPE> is_trajectory_valid(const std::vector<geometry_msgs::Point> &path,
+                                                           bool do_waypoint_validation);
 };
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include "C3FlightRecorder.h"
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+
+using namespace subjugator;
+
+C3FlightRecorder::C3FlightRecorder(const std::string &path, uint64_t capacity)
+  : fd_(-1), size_(sizeof(C3FlightLogHeader) + capacity * sizeof(C3FlightRecord)), count_(0)
+{
+  if (capacity == 0)
+    throw std::runtime_error("flight log capacity must be positive");
+
+  fd_ = open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd_ < 0)
+    throw std::runtime_error("could not open flight log " + path + ": " + strerror(errno));
+  if (ftruncate(fd_, size_) != 0)
+  {
+    std::string err = strerror(errno);
+    close(fd_);
+    throw std::runtime_error("could not size flight log " + path + ": " + err);
+  }
+
+  void *map = mmap(NULL, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+  if (map == MAP_FAILED)
+  {
+    std::string err = strerror(errno);
+    close(fd_);
+    throw std::runtime_error("could not map flight log " + path + ": " + err);
+  }
+
+  // Dirty every page up front so recording doesn't take a page fault each time it reaches a new one. On tmpfs they
+  // then stay writable for good; on a disk backed file writeback cleans them again every few seconds.
+  memset(map, 0, size_);
+
+  header_ = static_cast<C3FlightLogHeader *>(map);
+  records_ = reinterpret_cast<C3FlightRecord *>(header_ + 1);
+  memcpy(header_->magic, C3_FLIGHT_LOG_MAGIC, sizeof(header_->magic));
+  header_->version = C3_FLIGHT_LOG_VERSION;
+  header_->record_size = sizeof(C3FlightRecord);
+  header_->capacity = capacity;
+  header_->count = 0;
+}
+
+C3FlightRecorder::~C3FlightRecorder()
+{
+  munmap(header_, size_);
+  close(fd_);
+}
+
+static void copy(double *to, const Vector6d &from)
+{
+  Eigen::Map<Vector6d> map(to);
+  map = from;
+}
+
+void C3FlightRecorder::record(double t, const C3Trajectory &trajectory, const C3Trajectory::Waypoint &waypoint,
+                              double waypoint_t)
+{
+  C3FlightRecord &record = records_[count_ % header_->capacity];
+
+  // Mark the slot as being rewritten before touching the rest of it
+  __atomic_store_n(&record.seq, UINT64_MAX, __ATOMIC_RELAXED);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  C3Trajectory::PointWithAcceleration p = trajectory.getCurrentPoint();
+  const C3Trajectory::StepLimits &limits = trajectory.getStepLimits();
+  record.t = t;
+  record.waypoint_t = waypoint_t;
+  copy(record.r, waypoint.r.q);
+  copy(record.rdot, waypoint.r.qdot);
+  copy(record.q, p.q);
+  copy(record.qdot, p.qdot);
+  copy(record.qdotdot_b, trajectory.getBodyAcceleration());
+  copy(record.u_b, trajectory.getBodyJerk());
+  copy(record.vmin_b, limits.vmin_b);
+  copy(record.vmax_b, limits.vmax_b);
+  copy(record.amin_b, limits.amin_b);
+  copy(record.amax_b, limits.amax_b);
+
+  __atomic_store_n(&record.seq, count_, __ATOMIC_RELEASE);
+  ++count_;
+  __atomic_store_n(&header_->count, count_, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,73 @@
+#include "C3Rollout.h"
+
+using namespace subjugator;
+
+C3Rollout::C3Rollout(double dt, bool exact_integration, size_t reserved_samples)
+  : dt_(dt), exact_integration_(exact_integration), time_to_arrival_(0)
+{
+  samples_.reserve(reserved_samples);
+  sample_times_.reserve(reserved_samples);
+}
+
+bool C3Rollout::run(const C3Trajectory &start, const C3Trajectory::Waypoint &waypoint, double linear_tolerance,
+                    double angular_tolerance, double sample_period, double max_time)
+{
+  static const std::deque<C3Trajectory::Waypoint> no_queue;
+  return run(start, waypoint, no_queue, 0, linear_tolerance, angular_tolerance, sample_period, max_time);
+}
+
+bool C3Rollout::run(const C3Trajectory &start, const C3Trajectory::Waypoint &first,
+                    const std::deque<C3Trajectory::Waypoint> &queue, double blend_radius, double linear_tolerance,
+                    double angular_tolerance, double sample_period, double max_time)
+{
+  samples_.clear();
+  sample_times_.clear();
+  handovers_.clear();
+
+  C3Trajectory trajectory(start);
+  const C3Trajectory::Waypoint *waypoint = &first;
+  size_t next = 0;
+  // Same arrival condition the moveto action uses to succeed
+  bool stationary_goal = (queue.empty() ? first : queue.back()).r.qdot == Vector6d::Zero();
+  double t = 0;
+  double waypoint_t = 0;
+  double next_sample_t = 0;
+  bool handed_over = false;
+  while (true)
+  {
+    C3Trajectory::PointWithAcceleration p = trajectory.getCurrentPoint();
+    bool arrived =
+        next == queue.size() && stationary_goal && p.is_approximately(waypoint->r, linear_tolerance, angular_tolerance);
+    // A handover always starts a sample, so each leg's samples begin where it does
+    if (arrived || handed_over || t >= next_sample_t || t >= max_time)
+    {
+      if (handed_over)
+        handovers_.push_back(samples_.size());
+      samples_.push_back(p);
+      sample_times_.push_back(t);
+      if (t >= next_sample_t)
+        next_sample_t += sample_period;
+      handed_over = false;
+    }
+    if (arrived || t >= max_time)
+    {
+      time_to_arrival_ = t;
+      return arrived;
+    }
+
+    if (exact_integration_)
+      trajectory.update_exact(dt_, *waypoint, waypoint_t);
+    else
+      trajectory.update(dt_, *waypoint, waypoint_t);
+    t += dt_;
+    waypoint_t += dt_;
+
+    // Hand over as the trajectory thread does
+    if (next < queue.size() && trajectory.should_blend(*waypoint, blend_radius, angular_tolerance))
+    {
+      waypoint = &queue[next++];
+      waypoint_t = 0;
+      handed_over = true;
+    }
+  }
+}
@@ -0,0 +1,95 @@
+#include "C3RolloutPool.h"
+
+using namespace subjugator;
+
+C3RolloutPool::C3RolloutPool(size_t threads, double dt, bool exact_integration)
+  : shutdown_(false)
+  , batch_(0)
+  , size_(0)
+  , next_(0)
+  , remaining_(0)
+  , start_(NULL)
+  , waypoints_(NULL)
+  , path_check_(NULL)
+  , results_(NULL)
+{
+  threads = std::max<size_t>(threads, 1);
+  for (size_t i = 0; i < threads; ++i)
+    rollouts_.push_back(new C3Rollout(dt, exact_integration, 5000));
+  for (size_t i = 0; i < threads; ++i)
+    threads_.create_thread(boost::bind(&C3RolloutPool::worker, this, i));
+}
+
+C3RolloutPool::~C3RolloutPool()
+{
+  {
+    boost::mutex::scoped_lock lock(mutex_);
+    shutdown_ = true;
+  }
+  work_cv_.notify_all();
+  threads_.join_all();
+}
+
+void C3RolloutPool::run(const C3Trajectory &start, const std::vector<C3Trajectory::Waypoint> &waypoints,
+                        double linear_tolerance, double angular_tolerance, double max_time,
+                        const PathCheck &path_check, std::vector<Result> &results)
+{
+  results.resize(waypoints.size());
+  if (waypoints.empty())
+    return;
+
+  boost::mutex::scoped_lock lock(mutex_);
+  start_ = &start;
+  waypoints_ = &waypoints;
+  linear_tolerance_ = linear_tolerance;
+  angular_tolerance_ = angular_tolerance;
+  max_time_ = max_time;
+  path_check_ = &path_check;
+  results_ = &results;
+  size_ = waypoints.size();
+  next_ = 0;
+  remaining_ = size_;
+  ++batch_;
+  work_cv_.notify_all();
+
+  while (remaining_ > 0)
+    done_cv_.wait(lock);
+}
+
+void C3RolloutPool::worker(size_t index)
+{
+  C3Rollout &rollout = rollouts_[index];
+  unsigned int seen_batch = 0;
+  while (true)
+  {
+    size_t i;
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      while (!shutdown_ && (batch_ == seen_batch || next_ >= size_))
+      {
+        seen_batch = batch_;
+        work_cv_.wait(lock);
+      }
+      if (shutdown_)
+        return;
+      i = next_++;
+    }
+
+    // The batch can't finish (and its data can't go away) before remaining_ is decremented below
+    Result &result = (*results_)[i];
+    // Every sample is kept so the path check sees the whole rollout
+    result.arrived = rollout.run(*start_, (*waypoints_)[i], linear_tolerance_, angular_tolerance_, 0, max_time_);
+    result.time_to_arrival = rollout.time_to_arrival();
+    result.path_valid = !*path_check_ || (*path_check_)(rollout);
+
+    boost::mutex::scoped_lock lock(mutex_);
+    if (--remaining_ == 0)
+    {
+      start_ = NULL;
+      waypoints_ = NULL;
+      path_check_ = NULL;
+      results_ = NULL;
+      done_cv_.notify_all();
+    }
+  }
+}
@@ -1,6 +1,5 @@
 #include "C3Trajectory.h"
 #include <cmath>
-#include "AttitudeHelpers.h"
 #include "boost/tuple/tuple.hpp"
 
 using namespace subjugator;
@@ -8,7 +7,8 @@ using namespace Eigen;
 using namespace boost;
 using namespace std;
 
-static double sign(double x)
+template <typename Scalar>
+static Scalar sign(Scalar x)
 {
   if (x > 0)
     return 1;
@@ -17,62 +17,148 @@ static double sign(double x)
   return 0;
 }
 
-C3Trajectory::C3Trajectory(const Point &start, const Limits &limits)
-  : q(start.q), qdot(start.qdot), qdotdot_b(Vector6d::Zero()), u_b(Vector6d::Zero()), limits(limits)
+template <typename Scalar, int DOF>
+BasicC3Trajectory<Scalar, DOF>::BasicC3Trajectory(const Point &start, const Limits &limits)
+  : use_scalar_filter(false)
+  , q(start.q)
+  , qdot(start.qdot)
+  , qdotdot_b(Vector::Zero())
+  , u_b(Vector::Zero())
+  , R(C3Frame<Scalar, DOF>::rotation(start.q))
+  , limits(limits)
 {
+  step_limits.vmin_b = limits.vmin_b;
+  step_limits.vmax_b = limits.vmax_b;
+  step_limits.amin_b = limits.amin_b;
+  step_limits.amax_b = limits.amax_b;
 }
 
-static Vector6d apply(const Matrix4d &T, const Vector6d &q, double w)
+template <typename Scalar, int DOF>
+typename BasicC3Trajectory<Scalar, DOF>::Vector BasicC3Trajectory<Scalar, DOF>::to_body(const Vector &x,
+                                                                                       bool position) const
 {
-  Vector6d q_t;
-  q_t << q.head(3), w, 0, 0;
-  q_t.head(4) = T * q_t.head(4);
-  q_t.tail(3) = q.tail(3);
-  return q_t;
+  Vector x_b;
+  if (position)
+    x_b.template head<LINEAR>() = R.transpose() * (x.template head<LINEAR>() - q.template head<LINEAR>());
+  else
+    x_b.template head<LINEAR>() = R.transpose() * x.template head<LINEAR>();
+  x_b.template tail<ANGULAR>() = x.template tail<ANGULAR>();
+  return x_b;
+}
+
+template <typename Scalar, int DOF>
+typename BasicC3Trajectory<Scalar, DOF>::Vector BasicC3Trajectory<Scalar, DOF>::from_body(const Vector &x_b) const
+{
+  Vector x;
+  x.template head<LINEAR>() = R * x_b.template head<LINEAR>();
+  x.template tail<ANGULAR>() = x_b.template tail<ANGULAR>();
+  return x;
+}
+
+template <typename Scalar, int DOF>
+typename BasicC3Trajectory<Scalar, DOF>::PointWithAcceleration BasicC3Trajectory<Scalar, DOF>::getCurrentPoint() const
+{
+  return PointWithAcceleration(q, qdot, from_body(qdotdot_b));
+}
+
+template <typename Scalar, int DOF>
+bool BasicC3Trajectory<Scalar, DOF>::should_blend(const Waypoint &waypoint, Scalar blend_radius,
+                                                  Scalar angular_tolerance) const
+{
+  Vector error = waypoint.r.q - q;
+  for (int i = LINEAR; i < DOF; i++)
+    error(i) = remainder(error(i), Scalar(2 * M_PI));
+  if (error.template tail<ANGULAR>().norm() > angular_tolerance)
+    return false;
+
+  // Only the part of the braking distance that carries the sub towards the waypoint counts
+  LinearVector qdot_b = R.transpose() * qdot.template head<LINEAR>();
+  LinearVector braking_b;
+  for (int i = 0; i < LINEAR; i++)
+  {
+    Scalar decel = qdot_b(i) > 0 ? -limits.amin_b(i) : limits.amax_b(i);
+    braking_b(i) = decel > 0 ? qdot_b(i) * abs(qdot_b(i)) / (2 * decel) : 0;
+  }
+  LinearVector linear_error = error.template head<LINEAR>();
+  Scalar distance = linear_error.norm();
+  Scalar braking = distance > 0 ? (R * braking_b).dot(linear_error) / distance : 0;
+
+  return distance <= max(blend_radius, braking);
 }
 
-C3Trajectory::PointWithAcceleration C3Trajectory::getCurrentPoint() const
+template <typename Scalar, int DOF>
+void BasicC3Trajectory<Scalar, DOF>::update(Scalar dt, const Waypoint &waypoint, Scalar waypoint_t)
 {
-  return PointWithAcceleration(q, qdot, apply(C3Trajectory::transformation_pair(q).second, qdotdot_b, 0));
+  do_waypoint_validation = waypoint.do_waypoint_validation;
+
+  u_b = control(waypoint, waypoint_t, step_limits);
+
+  qdotdot_b += dt * u_b;
+  Vector qdotdot = from_body(qdotdot_b);
+  qdot += dt * qdotdot;
+  q += dt * qdot;
+
+  wrap_angles();
+  R = C3Frame<Scalar, DOF>::rotation(q);
 }
 
-void C3Trajectory::update(double dt, const Waypoint &waypoint, double waypoint_t)
+template <typename Scalar, int DOF>
+void BasicC3Trajectory<Scalar, DOF>::update_exact(Scalar dt, const Waypoint &waypoint, Scalar waypoint_t)
 {
   do_waypoint_validation = waypoint.do_waypoint_validation;
-  pair<Matrix4d, Matrix4d> Ts = transformation_pair(q);
-  const Matrix4d &T = Ts.first;
-  const Matrix4d &T_inv = Ts.second;
 
-  Vector6d q_b = apply(T, q, 1);
-  Vector6d r = waypoint.r.q + waypoint_t * waypoint.r.qdot;
-  Vector6d r_b = apply(T, r, 1);
-  Vector6d qdot_b = apply(T, qdot, 0);
-  Vector6d rdot_b = apply(T, waypoint.r.qdot, 0);
+  u_b = control(waypoint, waypoint_t, step_limits);
+
+  // Jerk is held constant over the step, so position, velocity and acceleration are integrated
+  // exactly instead of with the semi-implicit Euler used by update(). Body orientation is frozen
+  // at the start of the step.
+  q += dt * qdot + from_body(dt * dt / 2 * qdotdot_b + dt * dt * dt / 6 * u_b);
+  qdot += from_body(dt * qdotdot_b + dt * dt / 2 * u_b);
+  qdotdot_b += dt * u_b;
 
-  Vector6d vmin_b_prime = limits.vmin_b;
-  Vector6d vmax_b_prime = limits.vmax_b;
-  Vector3d posdelta = r_b.head(3);
+  wrap_angles();
+  R = C3Frame<Scalar, DOF>::rotation(q);
+}
+
+template <typename Scalar, int DOF>
+typename BasicC3Trajectory<Scalar, DOF>::Vector
+BasicC3Trajectory<Scalar, DOF>::control(const Waypoint &waypoint, Scalar waypoint_t, StepLimits &applied) const
+{
+  Vector q_b = to_body(q, true);
+  Vector r = waypoint.r.q + waypoint_t * waypoint.r.qdot;
+  Vector r_b = to_body(r, true);
+  Vector qdot_b = to_body(qdot, false);
+  Vector rdot_b = to_body(waypoint.r.qdot, false);
+
+  Vector &vmin_b_prime = applied.vmin_b;
+  Vector &vmax_b_prime = applied.vmax_b;
+  vmin_b_prime = limits.vmin_b;
+  vmax_b_prime = limits.vmax_b;
+  LinearVector posdelta = r_b.template head<LINEAR>();
 
   if (waypoint.speed > 0)
   {
-    for (int i = 0; i < 6; i++)
+    for (int i = 0; i < DOF; i++)
     {
       vmin_b_prime(i) = max(vmin_b_prime(i), -waypoint.speed);
       vmax_b_prime(i) = min(vmax_b_prime(i), waypoint.speed);
     }
   }
 
-  if (posdelta.norm() > 0.01 && waypoint.coordinate_unaligned)
+  if (posdelta.norm() > Scalar(0.01) && waypoint.coordinate_unaligned)
   {
-    pair<Vector3d, Vector3d> result = limit(vmin_b_prime.head(3), vmax_b_prime.head(3), posdelta);
-    vmin_b_prime.head(3) = result.first;
-    vmax_b_prime.head(3) = result.second;
+    pair<LinearVector, LinearVector> result =
+        limit(vmin_b_prime.template head<LINEAR>(), vmax_b_prime.template head<LINEAR>(), posdelta);
+    vmin_b_prime.template head<LINEAR>() = result.first;
+    vmax_b_prime.template head<LINEAR>() = result.second;
   }
 
-  Vector6d amin_b_prime = limits.amin_b;
-  Vector6d amax_b_prime = limits.amax_b;
+  Vector &amin_b_prime = applied.amin_b;
+  Vector &amax_b_prime = applied.amax_b;
+  amin_b_prime = limits.amin_b;
+  amax_b_prime = limits.amax_b;
 
-  for (int i = 0; i < 3; i++)
+  for (int i = 0; i < LINEAR; i++)
   {
     if (qdot_b(i) < 0)
     {
@@ -81,122 +167,184 @@ void C3Trajectory::update(double dt, const Waypoint &waypoint, double waypoint_t
     }
   }
 
-  for (int i = 3; i < 6; i++)
+  for (int i = LINEAR; i < DOF; i++)
   {
-    while (r_b(i) - q_b(i) > M_PI)
-      r_b(i) -= 2 * M_PI;
-    while (r_b(i) - q_b(i) < -M_PI)
-      r_b(i) += 2 * M_PI;
+    while (r_b(i) - q_b(i) > Scalar(M_PI))
+      r_b(i) -= Scalar(2 * M_PI);
+    while (r_b(i) - q_b(i) < -Scalar(M_PI))
+      r_b(i) += Scalar(2 * M_PI);
   }
 
-  for (int i = 0; i < 6; i++)
+  Vector u;
+  if (use_scalar_filter)
   {
-    u_b(i) = c3filter(q_b(i), qdot_b(i), qdotdot_b(i), r_b(i), rdot_b(i), 0, vmin_b_prime(i), vmax_b_prime(i),
+    for (int i = 0; i < DOF; i++)
+    {
+      u(i) = c3filter(q_b(i), qdot_b(i), qdotdot_b(i), r_b(i), rdot_b(i), 0, vmin_b_prime(i), vmax_b_prime(i),
                       amin_b_prime(i), amax_b_prime(i), limits.umax_b(i));
+    }
+  }
+  else
+  {
+    u = c3filter_vectorized(q_b.array(), qdot_b.array(), qdotdot_b.array(), r_b.array(), rdot_b.array(),
+                            Array::Zero(), vmin_b_prime.array(), vmax_b_prime.array(), amin_b_prime.array(),
+                            amax_b_prime.array(), limits.umax_b.array())
+            .matrix();
   }
 
-  qdotdot_b += dt * u_b;
-  Vector6d qdotdot = apply(T_inv, qdotdot_b, 0);
-  qdot += dt * qdotdot;
-  q += dt * qdot;
+  return u;
+}
 
-  for (int i = 3; i < 6; i++)
+template <typename Scalar, int DOF>
+void BasicC3Trajectory<Scalar, DOF>::wrap_angles()
+{
+  for (int i = LINEAR; i < DOF; i++)
   {
-    while (q(i) > M_PI)
-      q(i) -= 2 * M_PI;
-    while (q(i) < -M_PI)
-      q(i) += 2 * M_PI;
+    while (q(i) > Scalar(M_PI))
+      q(i) -= Scalar(2 * M_PI);
+    while (q(i) < -Scalar(M_PI))
+      q(i) += Scalar(2 * M_PI);
   }
 }
 
-static double deltav(double v, double edot, double edotdot)
+template <typename Scalar>
+static Scalar deltav(Scalar v, Scalar edot, Scalar edotdot)
 {
   return edotdot * abs(edotdot) + 2 * (edot - v);
 }
 
-static double ucv(double v, double edot, double edotdot, double umax)
+template <typename Scalar>
+static Scalar ucv(Scalar v, Scalar edot, Scalar edotdot, Scalar umax)
 {
-  double tmp = deltav(v, edot, edotdot);
+  Scalar tmp = deltav(v, edot, edotdot);
   return -umax * sign(tmp + (1 - abs(sign(tmp))) * edotdot);
 }
 
-static double ua(double a, double edotdot, double umax)
+template <typename Scalar>
+static Scalar ua(Scalar a, Scalar edotdot, Scalar umax)
 {
   return -umax * sign(edotdot - a);
 }
 
-static double uv(double v, double edot, double edotdot, double edotdotmin, double edotdotmax, double umax)
+template <typename Scalar>
+static Scalar uv(Scalar v, Scalar edot, Scalar edotdot, Scalar edotdotmin, Scalar edotdotmax, Scalar umax)
 {
   return max(ua(edotdotmin, edotdot, umax), min(ucv(v, edot, edotdot, umax), ua(edotdotmax, edotdot, umax)));
 }
 
-double C3Trajectory::c3filter(double q, double qdot, double qdotdot, double r, double rdot, double rdotdot, double vmin,
-                              double vmax, double amin, double amax, double umax)
+template <typename Scalar, int DOF>
+Scalar BasicC3Trajectory<Scalar, DOF>::c3filter(Scalar q, Scalar qdot, Scalar qdotdot, Scalar r, Scalar rdot,
+                                                Scalar rdotdot, Scalar vmin, Scalar vmax, Scalar amin, Scalar amax,
+                                                Scalar umax)
 {
-  double e = (q - r) / umax;
-  double edot = (qdot - rdot) / umax;
-  double edotdot = (qdotdot - rdotdot) / umax;
+  Scalar e = (q - r) / umax;
+  Scalar edot = (qdot - rdot) / umax;
+  Scalar edotdot = (qdotdot - rdotdot) / umax;
 
-  double edotmin = (vmin - rdot) / umax;
-  double edotmax = (vmax - rdot) / umax;
-  double edotdotmin = (amin - rdotdot) / umax;
-  double edotdotmax = (amax - rdotdot) / umax;
+  Scalar edotmin = (vmin - rdot) / umax;
+  Scalar edotmax = (vmax - rdot) / umax;
+  Scalar edotdotmin = (amin - rdotdot) / umax;
+  Scalar edotdotmax = (amax - rdotdot) / umax;
 
-  double delta = edot + edotdot * abs(edotdot) / 2;
-  double sd = sign(delta);
+  Scalar delta = edot + edotdot * abs(edotdot) / 2;
+  Scalar sd = sign(delta);
 
-  double S;
-  if (edotdotmax != 0 && edotdot <= edotdotmax && edot <= pow(edotdot, 2) / 2 - pow(edotdotmax, 2))
+  Scalar S;
+  if (edotdotmax != 0 && edotdot <= edotdotmax && edot <= pow(edotdot, Scalar(2)) / 2 - pow(edotdotmax, Scalar(2)))
   {
-    S = e - edotdotmax * (pow(edotdot, 2) - 2 * edot) / 4 - pow(pow(edotdot, 2) - 2 * edot, 2) / (8 * edotdotmax) -
-        edotdot * (3 * edot - pow(edotdot, 2)) / 3;
+    S = e - edotdotmax * (pow(edotdot, Scalar(2)) - 2 * edot) / 4 -
+        pow(pow(edotdot, Scalar(2)) - 2 * edot, Scalar(2)) / (8 * edotdotmax) -
+        edotdot * (3 * edot - pow(edotdot, Scalar(2))) / 3;
   }
-  else if (edotdotmin != 0 && edotdot >= edotdotmin && edot >= pow(edotdotmin, 2) - pow(edotdot, 2) / 2)
+  else if (edotdotmin != 0 && edotdot >= edotdotmin &&
+           edot >= pow(edotdotmin, Scalar(2)) - pow(edotdot, Scalar(2)) / 2)
   {
-    S = e - edotdotmin * (pow(edotdot, 2) + 2 * edot) / 4 - pow(pow(edotdot, 2) + 2 * edot, 2) / (8 * edotdotmin) +
-        edotdot * (3 * edot + pow(edotdot, 2)) / 3;
+    S = e - edotdotmin * (pow(edotdot, Scalar(2)) + 2 * edot) / 4 -
+        pow(pow(edotdot, Scalar(2)) + 2 * edot, Scalar(2)) / (8 * edotdotmin) +
+        edotdot * (3 * edot + pow(edotdot, Scalar(2))) / 3;
   }
   else
   {
-    S = e + edot * edotdot * sd - (pow(edotdot, 3)) / 6 * (1 - 3 * abs(sd)) +
-        sd / 4 * sqrt(2 * pow(pow(edotdot, 2) + 2 * edot * sd, 3));
+    S = e + edot * edotdot * sd - (pow(edotdot, Scalar(3))) / 6 * (1 - 3 * abs(sd)) +
+        sd / 4 * sqrt(2 * pow(pow(edotdot, Scalar(2)) + 2 * edot * sd, Scalar(3)));
   }
 
-  double uc = -umax * sign(S + (1 - abs(sign(S))) * (delta + (1 - abs(sd)) * edotdot));
-  double uv_emin = uv(edotmin, edot, edotdot, edotdotmin, edotdotmax, umax);
-  double uv_emax = uv(edotmax, edot, edotdot, edotdotmin, edotdotmax, umax);
+  Scalar uc = -umax * sign(S + (1 - abs(sign(S))) * (delta + (1 - abs(sd)) * edotdot));
+  Scalar uv_emin = uv(edotmin, edot, edotdot, edotdotmin, edotdotmax, umax);
+  Scalar uv_emax = uv(edotmax, edot, edotdot, edotdotmin, edotdotmax, umax);
 
   return max(uv_emin, min(uc, uv_emax));
 }
 
-pair<Matrix4d, Matrix4d> C3Trajectory::transformation_pair(const Vector6d &q)
+template <typename Array>
+static Array ucv_vectorized(const Array &v, const Array &edot, const Array &edotdot, const Array &umax)
 {
-  Matrix4d R;
-  R.block<3, 3>(0, 0) = AttitudeHelpers::EulerToRotation(q.tail(3));
-  R.block<1, 3>(3, 0).fill(0);
-  R.block<3, 1>(0, 3).fill(0);
-  R(3, 3) = 1;
+  Array tmp = edotdot * edotdot.abs() + 2 * (edot - v);
+  return -umax * (tmp + (1 - tmp.sign().abs()) * edotdot).sign();
+}
 
-  Matrix4d T = Matrix4d::Identity();
-  T.block<3, 1>(0, 3) = -q.head(3);
+template <typename Array>
+static Array uv_vectorized(const Array &v, const Array &edot, const Array &edotdot, const Array &edotdotmin,
+                           const Array &edotdotmax, const Array &umax)
+{
+  Array ua_min = -umax * (edotdot - edotdotmin).sign();
+  Array ua_max = -umax * (edotdot - edotdotmax).sign();
+  return ua_min.max(ucv_vectorized(v, edot, edotdot, umax).min(ua_max));
+}
+
+// Same math as c3filter, but all three switching-surface branches are evaluated for every axis and
+// the result is picked with select(). Lanes that take a different branch may compute inf/NaN in the
+// unused terms; those are discarded by the select and never reach the output.
+template <typename Scalar, int DOF>
+typename BasicC3Trajectory<Scalar, DOF>::Array BasicC3Trajectory<Scalar, DOF>::c3filter_vectorized(
+    const Array &q, const Array &qdot, const Array &qdotdot, const Array &r, const Array &rdot, const Array &rdotdot,
+    const Array &vmin, const Array &vmax, const Array &amin, const Array &amax, const Array &umax)
+{
+  Array e = (q - r) / umax;
+  Array edot = (qdot - rdot) / umax;
+  Array edotdot = (qdotdot - rdotdot) / umax;
+
+  Array edotmin = (vmin - rdot) / umax;
+  Array edotmax = (vmax - rdot) / umax;
+  Array edotdotmin = (amin - rdotdot) / umax;
+  Array edotdotmax = (amax - rdotdot) / umax;
+
+  Array edotdot2 = edotdot * edotdot;
+  Array delta = edot + edotdot * edotdot.abs() / 2;
+  Array sd = delta.sign();
 
-  pair<Matrix4d, Matrix4d> result;
-  result.first = R.transpose() * T;  // NED -> BODY
+  Array kmax = edotdot2 - 2 * edot;
+  Array S_max = e - edotdotmax * kmax / 4 - kmax * kmax / (8 * edotdotmax) - edotdot * (3 * edot - edotdot2) / 3;
 
-  T.block<3, 1>(0, 3) = q.head(3);
-  result.second = T * R;  // BODY -> NED
+  Array kmin = edotdot2 + 2 * edot;
+  Array S_min = e - edotdotmin * kmin / 4 - kmin * kmin / (8 * edotdotmin) + edotdot * (3 * edot + edotdot2) / 3;
 
-  return result;
+  Array kd = edotdot2 + 2 * edot * sd;
+  Array S_d = e + edot * edotdot * sd - (edotdot2 * edotdot) / 6 * (1 - 3 * sd.abs()) +
+              sd / 4 * (2 * (kd * kd * kd)).sqrt();
+
+  Array S = (edotdotmax != 0 && edotdot <= edotdotmax && edot <= edotdot2 / 2 - edotdotmax * edotdotmax)
+                .select(S_max, (edotdotmin != 0 && edotdot >= edotdotmin &&
+                                edot >= edotdotmin * edotdotmin - edotdot2 / 2)
+                                   .select(S_min, S_d));
+
+  Array uc = -umax * (S + (1 - S.sign().abs()) * (delta + (1 - sd.abs()) * edotdot)).sign();
+  Array uv_emin = uv_vectorized(edotmin, edot, edotdot, edotdotmin, edotdotmax, umax);
+  Array uv_emax = uv_vectorized(edotmax, edot, edotdot, edotdotmin, edotdotmax, umax);
+
+  return uv_emin.max(uc.min(uv_emax));
 }
 
-std::pair<Vector3d, Vector3d> C3Trajectory::limit(const Vector3d &vmin, const Vector3d &vmax, const Vector3d &delta)
+template <typename Scalar, int DOF>
+std::pair<typename BasicC3Trajectory<Scalar, DOF>::LinearVector, typename BasicC3Trajectory<Scalar, DOF>::LinearVector>
+BasicC3Trajectory<Scalar, DOF>::limit(const LinearVector &vmin, const LinearVector &vmax, const LinearVector &delta)
 {
-  Vector3d adelta = delta.array().abs();
+  LinearVector adelta = delta.array().abs();
 
-  double maxtime = 0;
-  for (int i = 0; i < 3; i++)
+  Scalar maxtime = 0;
+  for (int i = 0; i < LINEAR; i++)
   {
-    double time;
+    Scalar time;
     if (delta(i) > 0)
     {
       time = adelta(i) / vmax(i);
@@ -211,18 +359,18 @@ std::pair<Vector3d, Vector3d> C3Trajectory::limit(const Vector3d &vmin, const Ve
 
   assert(maxtime > 0);
 
-  Vector3d av_prime = adelta / maxtime;
-  Vector3d maxv_prime;
-  Vector3d minv_prime;
+  LinearVector av_prime = adelta / maxtime;
+  LinearVector maxv_prime;
+  LinearVector minv_prime;
 
-  for (int i = 0; i < 3; i++)
+  for (int i = 0; i < LINEAR; i++)
   {
-    if (delta(i) > 0.001)
+    if (delta(i) > Scalar(0.001))
     {
       maxv_prime(i) = av_prime(i);
       minv_prime(i) = vmin(i);
     }
-    else if (delta(i) < -0.001)
+    else if (delta(i) < -Scalar(0.001))
     {
       maxv_prime(i) = vmax(i);
       minv_prime(i) = -av_prime(i);
@@ -236,3 +384,10 @@ std::pair<Vector3d, Vector3d> C3Trajectory::limit(const Vector3d &vmin, const Ve
 
   return make_pair(minv_prime, maxv_prime);
 }
+
+namespace subjugator
+{
+template class BasicC3Trajectory<double, 6>;
+template class BasicC3Trajectory<float, 6>;
+template class BasicC3Trajectory<double, 3>;
+};
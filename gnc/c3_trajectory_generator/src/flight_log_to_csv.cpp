@@ -0,0 +1,161 @@
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <string>
+
+#include "C3FlightRecorder.h"
+
+using namespace subjugator;
+
+// Converts a window of a C3 flight log to CSV on stdout, oldest record first.
+//   c3_flight_log_to_csv LOG [--last SECONDS] [--from T] [--to T]
+// --from/--to are absolute times as recorded (ROS time in seconds), --last is relative to the newest record.
+
+static int usage()
+{
+  fprintf(stderr, "usage: c3_flight_log_to_csv LOG [--last SECONDS] [--from T] [--to T]\n");
+  return 2;
+}
+
+static void print_names(const char *name)
+{
+  for (int i = 0; i < 6; i++)
+    printf(",%s%d", name, i);
+}
+
+static void print_values(const double *values)
+{
+  for (int i = 0; i < 6; i++)
+    printf(",%.12g", values[i]);
+}
+
+int main(int argc, char **argv)
+{
+  if (argc < 2)
+    return usage();
+  std::string path = argv[1];
+  double from = -std::numeric_limits<double>::infinity();
+  double to = std::numeric_limits<double>::infinity();
+  double last = -1;
+  for (int i = 2; i < argc; i += 2)
+  {
+    if (i + 1 >= argc)
+      return usage();
+    if (!strcmp(argv[i], "--last"))
+      last = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "--from"))
+      from = atof(argv[i + 1]);
+    else if (!strcmp(argv[i], "--to"))
+      to = atof(argv[i + 1]);
+    else
+      return usage();
+  }
+
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0)
+  {
+    fprintf(stderr, "could not open %s: %s\n", path.c_str(), strerror(errno));
+    return 1;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    fprintf(stderr, "could not stat %s: %s\n", path.c_str(), strerror(errno));
+    close(fd);
+    return 1;
+  }
+  if ((size_t)st.st_size < sizeof(C3FlightLogHeader))
+  {
+    fprintf(stderr, "%s is too short to be a C3 flight log (%lld bytes)\n", path.c_str(), (long long)st.st_size);
+    close(fd);
+    return 1;
+  }
+  // The recorder may still be writing, map it read-only and take the count once
+  void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  if (map == MAP_FAILED)
+  {
+    fprintf(stderr, "could not map %s: %s\n", path.c_str(), strerror(errno));
+    close(fd);
+    return 1;
+  }
+  const C3FlightLogHeader *header = static_cast<const C3FlightLogHeader *>(map);
+  if (memcmp(header->magic, C3_FLIGHT_LOG_MAGIC, sizeof(header->magic)) || header->version != C3_FLIGHT_LOG_VERSION ||
+      header->record_size != sizeof(C3FlightRecord) ||
+      (size_t)st.st_size < sizeof(C3FlightLogHeader) + header->capacity * sizeof(C3FlightRecord))
+  {
+    fprintf(stderr, "%s is not a version %u C3 flight log\n", path.c_str(), C3_FLIGHT_LOG_VERSION);
+    munmap(map, st.st_size);
+    close(fd);
+    return 1;
+  }
+  const C3FlightRecord *records = reinterpret_cast<const C3FlightRecord *>(header + 1);
+
+  uint64_t count = __atomic_load_n(&header->count, __ATOMIC_ACQUIRE);
+  uint64_t oldest = count > header->capacity ? count - header->capacity : 0;
+  if (last >= 0 && count > 0)
+    from = std::max(from, records[(count - 1) % header->capacity].t - last);
+
+  printf("seq,t,waypoint_t");
+  print_names("r");
+  print_names("rdot");
+  print_names("q");
+  print_names("qdot");
+  print_names("qdotdot_b");
+  print_names("u_b");
+  print_names("vmin_b");
+  print_names("vmax_b");
+  print_names("amin_b");
+  print_names("amax_b");
+  printf("\n");
+
+  uint64_t skipped = 0;
+  for (uint64_t n = oldest; n < count; n++)
+  {
+    // Read as a seqlock: seq before and after the copy, overwritten since we read count, or in the middle of being
+    // rewritten if either isn't n
+    const C3FlightRecord &slot = records[n % header->capacity];
+    C3FlightRecord record;
+    bool complete = __atomic_load_n(&slot.seq, __ATOMIC_ACQUIRE) == n;
+    if (complete)
+    {
+      memcpy(&record, &slot, sizeof(record));
+      // Keeps the copy from being reordered after the second load
+      std::atomic_thread_fence(std::memory_order_acquire);
+      complete = __atomic_load_n(&slot.seq, __ATOMIC_RELAXED) == n;
+    }
+    if (!complete)
+    {
+      skipped++;
+      continue;
+    }
+    if (record.t < from || record.t > to)
+      continue;
+
+    printf("%llu,%.12g,%.12g", (unsigned long long)record.seq, record.t, record.waypoint_t);
+    print_values(record.r);
+    print_values(record.rdot);
+    print_values(record.q);
+    print_values(record.qdot);
+    print_values(record.qdotdot_b);
+    print_values(record.u_b);
+    print_values(record.vmin_b);
+    print_values(record.vmax_b);
+    print_values(record.amin_b);
+    print_values(record.amax_b);
+    printf("\n");
+  }
+  if (skipped)
+    fprintf(stderr, "skipped %llu records overwritten while reading\n", (unsigned long long)skipped);
+
+  munmap(map, st.st_size);
+  close(fd);
+  return 0;
+}
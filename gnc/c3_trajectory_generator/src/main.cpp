@@ -0,0 +1,18 @@
+#include <nodelet/loader.h>
+#include <ros/ros.h>
+
+// Loads the c3_trajectory_generator nodelet on its own, the same as `rosrun nodelet nodelet standalone`
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "c3_trajectory_generator");
+
+  nodelet::Loader loader(false);
+  nodelet::V_string nodelet_argv(argv + 1, argv + argc);
+  if (!loader.load(ros::this_node::getName(), "c3_trajectory_generator/C3TrajectoryGeneratorNodelet",
+                   ros::names::getRemappings(), nodelet_argv))
+    return 1;
+
+  ros::spin();
+
+  return 0;
+}
@@ -1,6 +1,9 @@
 #include <actionlib/server/simple_action_server.h>
 #include <geometry_msgs/PoseStamped.h>
 #include <nav_msgs/Odometry.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <ros/callback_queue.h>
 #include <ros/ros.h>
 #include <tf/transform_listener.h>
 
@@ -10,13 +13,33 @@
 #include <ros_alarms/listener.hpp>
 
 #include <mil_msgs/MoveToAction.h>
+#include "C3FlightRecorder.h"
+#include "C3Rollout.h"
+#include "C3RolloutPool.h"
 #include "C3Trajectory.h"
+#include "SampleRing.h"
+#include "TripleBuffer.h"
+#include "c3_trajectory_generator/MoveToSequenceAction.h"
+#include "c3_trajectory_generator/PreviewTrajectory.h"
 #include "c3_trajectory_generator/SetDisabled.h"
+#include "c3_trajectory_generator/TickStatistics.h"
+#include "c3_trajectory_generator/TimeToReach.h"
+#include "c3_trajectory_generator/TrajectorySpline.h"
 
 #include <waypoint_validity.hpp>
 
 #include <boost/assign/list_of.hpp>
+#include <boost/optional.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/unordered_map.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <cstring>
+#include <deque>
+#include <pthread.h>
 
 using namespace std;
 using namespace geometry_msgs;
@@ -83,6 +106,75 @@ Pose Pose_from_Waypoint(const subjugator::C3Trajectory::Waypoint &wp)
   return res;
 }
 
+// Everything the other threads need to know about the trajectory, published by the trajectory thread every tick
+struct TrajectoryState
+{
+  // False while killed, disabled or waiting for odom
+  bool active;
+  ros::Time t;
+  boost::optional<subjugator::C3Trajectory> trajectory;
+  subjugator::C3Trajectory::Waypoint waypoint;
+  ros::Time waypoint_t;
+  unsigned int sequence_index;
+  // Waypoints still queued after waypoint
+  unsigned int remaining_waypoints;
+  // The first min(remaining_waypoints, SPLINE_WAYPOINTS) of them and when to hand over, so the spline can follow a
+  // sequence without the trajectory thread copying the whole queue
+  static const unsigned int SPLINE_WAYPOINTS = 2;
+  std::array<subjugator::C3Trajectory::Waypoint, SPLINE_WAYPOINTS> next_waypoints;
+  double blend_radius, blend_angular_tolerance;
+  // Last TrajectoryCommand the trajectory thread applied
+  unsigned int command_seq;
+
+  TrajectoryState()
+    : active(false)
+    , sequence_index(0)
+    , remaining_waypoints(0)
+    , blend_radius(0)
+    , blend_angular_tolerance(0)
+    , command_seq(0)
+  {
+  }
+};
+
+// Timing of one trajectory tick
+struct TickSample
+{
+  ros::WallTime t;
+  double duration;
+  double lateness;
+  double substeps;
+};
+
+// Sent by the goal thread to the trajectory thread. Each command replaces the previous one entirely.
+struct TrajectoryCommand
+{
+  enum Mode
+  {
+    MOVE,     // move to waypoint, continuing from the current trajectory
+    RESTART,  // restart the trajectory at rest at waypoint
+    STOP      // restart the trajectory at rest wherever it is
+  };
+
+  unsigned int seq;
+  Mode mode;
+  subjugator::C3Trajectory::Waypoint waypoint;
+  // Waypoints of a moveto_sequence goal that come after waypoint
+  std::deque<subjugator::C3Trajectory::Waypoint> queue;
+  double blend_radius;
+  // Orientation error below which the trajectory may hand over to the next waypoint
+  double blend_angular_tolerance;
+  // The kill alarm as the goal thread last read it. The trajectory thread drops its trajectory while it is raised.
+  bool killed;
+};
+
+// The node runs on four threads so that the 50 Hz setpoint never waits on anything else:
+//  - the trajectory thread (dedicated, optionally realtime priority) receives odom, integrates the trajectory and
+//    publishes it
+//  - the goal thread (the nodelet's callback queue) receives ogrids, services the action servers, validates goals and sends them over
+//  - the visualization thread publishes debug topics and the trajectory spline
+//  - the preview thread serves rollout services
+// The trajectory thread never takes a lock: commands come in and its state goes out through TripleBuffers.
 struct Node
 {
   ros::NodeHandle nh;
@@ -94,42 +186,119 @@ struct Node
   string fixed_frame;
   subjugator::C3Trajectory::Limits limits;
   ros::Duration traj_dt;
+  bool exact_integration;
+  ros::Duration traj_exact_dt;
 
   ros::Subscriber odom_sub;
   actionlib::SimpleActionServer<mil_msgs::MoveToAction> actionserver;
+  actionlib::SimpleActionServer<MoveToSequenceAction> sequence_actionserver;
   ros::Publisher trajectory_pub;
   ros::Publisher trajectory_vis_pub;
   ros::Publisher waypoint_pose_pub;
+  ros::Publisher trajectory_spline_pub;
+  // The spline is republished every spline_period, or as soon as the waypoint changes, and covers spline_horizon
+  ros::Duration spline_period;
+  ros::Duration spline_horizon;
+  ros::Duration spline_knot_period;
+  // The lookahead is integrated exactly at this step, whatever integration_mode is
+  ros::Duration spline_dt;
+  ros::Time last_spline_t;
+  ros::Time last_spline_waypoint_t;
   ros::ServiceServer set_disabled_service;
 
+  // Trajectory thread
+  ros::CallbackQueue trajectory_queue;
+  boost::thread trajectory_thread;
+  // Set when the nodelet is unloaded, as nh stays ok until the whole process shuts down
+  std::atomic<bool> stopping;
   ros::Timer update_timer;
-
-  bool disabled;
   boost::scoped_ptr<subjugator::C3Trajectory> c3trajectory;
+  // Optional post-mortem log of every integration step
+  boost::scoped_ptr<subjugator::C3FlightRecorder> flight_recorder;
+  // Steps are recorded at most this often, every one if 0. Opt in to cover a longer stretch at the fixed-mode step.
+  ros::Duration flight_log_period;
+  ros::Time next_flight_record_t;
   ros::Time c3trajectory_t;
-
   subjugator::C3Trajectory::Waypoint current_waypoint;
   ros::Time current_waypoint_t;
-
+  // Waypoints of the active moveto_sequence goal that come after current_waypoint
+  std::deque<subjugator::C3Trajectory::Waypoint> waypoint_queue;
+  double blend_radius, blend_angular_tolerance;
+  unsigned int sequence_index;
+  unsigned int applied_command_seq;
+  // From the last command, raised until the goal thread has seen the alarm cleared
+  bool killed;
+
+  // Hand-over between threads
+  subjugator::TripleBuffer<TrajectoryCommand> commands;
+  subjugator::TripleBuffer<TrajectoryState> goal_state;
+  subjugator::TripleBuffer<TrajectoryState> visualization_state;
+  subjugator::TripleBuffer<TrajectoryState> preview_state;
+  std::atomic<bool> disabled;
+
+  // Goal thread
+  ros::Timer goal_timer;
+  unsigned int sent_command_seq;
+  // The only place the kill alarm is read, once per goal tick, and sent over with every command
+  bool kill_raised;
+  subjugator::C3Trajectory::Point last_trajectory_point;
+  unsigned int last_sequence_index;
   double linear_tolerance, angular_tolerance;
-
   WaypointValidity waypoint_validity_;
   bool waypoint_check_;
+  // Coarse rollout of a new goal used to check the path to it, not just its endpoint
+  boost::scoped_ptr<subjugator::C3Rollout> validation_rollout_;
+  std::vector<geometry_msgs::Point> validation_path_;
+
+  // Visualization thread
+  ros::CallbackQueue visualization_queue;
+  boost::scoped_ptr<ros::AsyncSpinner> visualization_spinner;
+  ros::Timer visualization_timer;
+  // Tick timing is only recorded while someone subscribes to tick_statistics
+  ros::Publisher tick_statistics_pub;
+  ros::WallTimer tick_statistics_timer;
+  ros::WallDuration tick_statistics_window;
+  std::atomic<bool> record_ticks;
+  subjugator::SampleRing<TickSample, 1024> tick_samples;
+  std::vector<TickSample> tick_drain;
+  std::deque<TickSample> tick_window;
+  std::vector<double> tick_scratch;
+
+  // Preview thread. Previews are rolled out on their own thread so they never hold up the other ones
+  ros::CallbackQueue preview_queue;
+  boost::scoped_ptr<ros::AsyncSpinner> preview_spinner;
+  ros::ServiceServer preview_service;
+  boost::scoped_ptr<subjugator::C3Rollout> preview_rollout;
+  // Candidate ranking, served from the preview thread and fanned out to a pool of rollout threads
+  ros::ServiceServer time_to_reach_service;
+  boost::scoped_ptr<subjugator::C3RolloutPool> rollout_pool;
+  std::vector<subjugator::C3Trajectory::Waypoint> time_to_reach_waypoints;
+  std::vector<subjugator::C3RolloutPool::Result> time_to_reach_results;
 
   bool set_disabled(SetDisabledRequest &request, SetDisabledResponse &response)
   {
     disabled = request.disabled;
-    if (disabled)
-    {
-      c3trajectory.reset();
-    }
     return true;
   }
 
-  Node()
-    : private_nh("~")
+  // Named apart from the members, so the initializers and the body use the members (WaypointValidity keeps a pointer
+  // to nh, and needs it non-const)
+  Node(const ros::NodeHandle &node_nh, const ros::NodeHandle &node_private_nh)
+    : nh(node_nh)
+    , private_nh(node_private_nh)
     , actionserver(nh, "moveto", false)
+    , sequence_actionserver(nh, "moveto_sequence", false)
+    , blend_radius(0)
+    , blend_angular_tolerance(0)
+    , sequence_index(0)
+    , applied_command_seq(0)
+    , killed(true)
     , disabled(false)
+    , stopping(false)
+    , record_ticks(false)
+    , sent_command_seq(0)
+    , kill_raised(true)
+    , last_sequence_index(0)
     , kill_listener(nh, "kill")
     , waypoint_validity_(nh)
   {
@@ -150,27 +319,199 @@ struct Node
     limits.umax_b = mil_tools::getParam<subjugator::Vector6d>(private_nh, "umax_b");
     traj_dt = mil_tools::getParam<ros::Duration>(private_nh, "traj_dt", ros::Duration(0.0001));
 
-    waypoint_check_ = mil_tools::getParam<bool>(private_nh, "waypoint_check");
+    // "fixed" steps the C3 filter every traj_dt with semi-implicit Euler, "exact" integrates the
+    // piecewise-constant jerk exactly and can take the much coarser traj_exact_dt step
+    std::string integration_mode = mil_tools::getParam<std::string>(private_nh, "integration_mode", "fixed");
+    if (integration_mode != "fixed" && integration_mode != "exact")
+      throw std::runtime_error("integration_mode must be 'fixed' or 'exact', got '" + integration_mode + "'");
+    exact_integration = integration_mode == "exact";
+    traj_exact_dt = mil_tools::getParam<ros::Duration>(private_nh, "traj_exact_dt", ros::Duration(0.002));
+
+    std::string flight_log = mil_tools::getParam<std::string>(private_nh, "flight_log", "");
+    if (!flight_log.empty())
+    {
+      // 504 byte records, about 16 MB: a minute of flight at the exact-mode step, or a few seconds at the fixed-mode
+      // one unless flight_log_period thins it out
+      int flight_log_records = mil_tools::getParam<int>(private_nh, "flight_log_records", 1 << 15);
+      flight_log_period = mil_tools::getParam<ros::Duration>(private_nh, "flight_log_period", ros::Duration(0));
+      flight_recorder.reset(new subjugator::C3FlightRecorder(flight_log, flight_log_records));
+    }
 
-    odom_sub = nh.subscribe<Odometry>("odom", 1, boost::bind(&Node::odom_callback, this, _1));
+    waypoint_check_ = mil_tools::getParam<bool>(private_nh, "waypoint_check");
+    // Path deviation from the real trajectory stays a few cm at this step, well below an ogrid cell
+    double trajectory_check_dt = mil_tools::getParam<double>(private_nh, "trajectory_check_dt", 0.05);
+    validation_rollout_.reset(new subjugator::C3Rollout(trajectory_check_dt, true, 5000));
+    validation_path_.reserve(5000);
 
     trajectory_pub = nh.advertise<PoseTwistStamped>("trajectory", 1);
     trajectory_vis_pub = private_nh.advertise<PoseStamped>("trajectory_v", 1);
     waypoint_pose_pub = private_nh.advertise<PoseStamped>("waypoint", 1);
+    trajectory_spline_pub = nh.advertise<TrajectorySpline>("trajectory_spline", 1);
+    spline_period = mil_tools::getParam<ros::Duration>(private_nh, "spline_period", ros::Duration(0.1));
+    spline_horizon = mil_tools::getParam<ros::Duration>(private_nh, "spline_horizon", ros::Duration(0.3));
+    spline_knot_period = mil_tools::getParam<ros::Duration>(private_nh, "spline_knot_period", ros::Duration(0.02));
+    spline_dt = mil_tools::getParam<ros::Duration>(private_nh, "spline_dt", ros::Duration(0.002));
 
-    update_timer = nh.createTimer(ros::Duration(1. / 50), boost::bind(&Node::timer_callback, this, _1));
+    goal_timer = nh.createTimer(ros::Duration(1. / 50), boost::bind(&Node::goal_callback, this, _1));
 
     actionserver.start();
+    sequence_actionserver.start();
 
     set_disabled_service = private_nh.advertiseService<SetDisabledRequest, SetDisabledResponse>(
         "set_disabled", boost::bind(&Node::set_disabled, this, _1, _2));
+
+    ros::NodeHandle visualization_nh(private_nh);
+    visualization_nh.setCallbackQueue(&visualization_queue);
+    visualization_timer =
+        visualization_nh.createTimer(ros::Duration(1. / 50), boost::bind(&Node::visualization_callback, this, _1));
+    tick_statistics_pub = private_nh.advertise<TickStatistics>("tick_statistics", 1);
+    tick_statistics_window = ros::WallDuration(mil_tools::getParam<double>(private_nh, "tick_statistics_window", 10));
+    tick_statistics_timer = visualization_nh.createWallTimer(
+        ros::WallDuration(mil_tools::getParam<double>(private_nh, "tick_statistics_period", 1)),
+        boost::bind(&Node::tick_statistics_callback, this, _1));
+    visualization_spinner.reset(new ros::AsyncSpinner(1, &visualization_queue));
+    visualization_spinner->start();
+
+    preview_rollout.reset(new subjugator::C3Rollout((exact_integration ? traj_exact_dt : traj_dt).toSec(),
+                                                    exact_integration, 10000));
+    ros::NodeHandle preview_nh(private_nh);
+    preview_nh.setCallbackQueue(&preview_queue);
+    preview_service = preview_nh.advertiseService<PreviewTrajectoryRequest, PreviewTrajectoryResponse>(
+        "preview", boost::bind(&Node::preview, this, _1, _2));
+
+    int rollout_threads =
+        mil_tools::getParam<int>(private_nh, "rollout_threads", std::max(1u, boost::thread::hardware_concurrency()));
+    double time_to_reach_dt = mil_tools::getParam<double>(private_nh, "time_to_reach_dt", 0.02);
+    rollout_pool.reset(new subjugator::C3RolloutPool(rollout_threads, time_to_reach_dt, true));
+    time_to_reach_service = preview_nh.advertiseService<TimeToReachRequest, TimeToReachResponse>(
+        "time_to_reach", boost::bind(&Node::time_to_reach, this, _1, _2));
+
+    preview_spinner.reset(new ros::AsyncSpinner(1, &preview_queue));
+    preview_spinner->start();
+
+    ros::NodeHandle trajectory_nh(nh);
+    trajectory_nh.setCallbackQueue(&trajectory_queue);
+    odom_sub = trajectory_nh.subscribe<Odometry>("odom", 1, boost::bind(&Node::odom_callback, this, _1));
+    update_timer = trajectory_nh.createTimer(ros::Duration(1. / 50), boost::bind(&Node::timer_callback, this, _1));
+    trajectory_thread = boost::thread(boost::bind(&Node::trajectory_thread_main, this));
+
+    // SCHED_FIFO needs CAP_SYS_NICE or an rtprio limit, without it the thread just keeps the default policy
+    int priority = mil_tools::getParam<int>(private_nh, "trajectory_thread_priority", 0);
+    if (priority > 0)
+    {
+      sched_param param;
+      param.sched_priority = priority;
+      int err = pthread_setschedparam(trajectory_thread.native_handle(), SCHED_FIFO, &param);
+      if (err != 0)
+        ROS_WARN_STREAM("Could not give the trajectory thread realtime priority " << priority << ": " << strerror(err));
+    }
+  }
+
+  ~Node()
+  {
+    visualization_spinner->stop();
+    preview_spinner->stop();
+    stopping = true;
+    trajectory_thread.join();
+  }
+
+  void trajectory_thread_main()
+  {
+    while (nh.ok() && !stopping)
+      trajectory_queue.callAvailable(ros::WallDuration(0.1));
+  }
+
+  bool preview(PreviewTrajectoryRequest &request, PreviewTrajectoryResponse &response)
+  {
+    boost::scoped_ptr<subjugator::C3Trajectory> start;
+    if (request.use_current_start)
+    {
+      preview_state.update();
+      const TrajectoryState &state = preview_state.front();
+      if (!state.active)
+      {
+        response.success = false;
+        response.error = "no current trajectory";
+        return true;
+      }
+      start.reset(new subjugator::C3Trajectory(*state.trajectory));
+    }
+    else
+    {
+      start.reset(new subjugator::C3Trajectory(Point_from_PoseTwist(request.start.pose, request.start.twist), limits));
+    }
+
+    subjugator::C3Trajectory::Waypoint waypoint(Point_from_PoseTwist(request.goal.pose, request.goal.twist),
+                                                request.speed, !request.uncoordinated);
+    double sample_period = request.sample_period > 0 ? request.sample_period : 0.1;
+    double max_time = request.max_time > 0 ? request.max_time : 120;
+
+    response.success = preview_rollout->run(*start, waypoint, max(1e-3, request.linear_tolerance),
+                                            max(1e-3, request.angular_tolerance), sample_period, max_time);
+    response.error = response.success ? "" : "did not arrive within max_time";
+    response.time_to_arrival = preview_rollout->time_to_arrival();
+    response.times = preview_rollout->sample_times();
+    response.path.reserve(preview_rollout->samples().size());
+    for (const auto &p : preview_rollout->samples())
+      response.path.push_back(PoseTwist_from_PointWithAcceleration(p));
+    return true;
+  }
+
+  bool time_to_reach(TimeToReachRequest &request, TimeToReachResponse &response)
+  {
+    boost::scoped_ptr<subjugator::C3Trajectory> start;
+    if (request.use_current_start)
+    {
+      preview_state.update();
+      const TrajectoryState &state = preview_state.front();
+      if (!state.active)
+      {
+        response.success = false;
+        response.error = "no current trajectory";
+        return true;
+      }
+      start.reset(new subjugator::C3Trajectory(*state.trajectory));
+    }
+    else
+    {
+      start.reset(new subjugator::C3Trajectory(Point_from_PoseTwist(request.start.pose, request.start.twist), limits));
+    }
+    time_to_reach_waypoints.clear();
+    for (const auto &goal : request.goals)
+      time_to_reach_waypoints.push_back(subjugator::C3Trajectory::Waypoint(
+          Point_from_PoseTwist(goal.pose, goal.twist), request.speed, !request.uncoordinated));
+
+    subjugator::C3RolloutPool::PathCheck path_check;
+    if (request.check_paths)
+    {
+      path_check = [this](const subjugator::C3Rollout &rollout) {
+        std::vector<geometry_msgs::Point> path;
+        path.reserve(rollout.samples().size());
+        for (const auto &p : rollout.samples())
+          path.push_back(vec2xyz<Point>(p.q.head(3)));
+        return waypoint_validity_.is_trajectory_valid(path, true).first;
+      };
+    }
+
+    rollout_pool->run(*start, time_to_reach_waypoints, max(1e-3, request.linear_tolerance),
+                      max(1e-3, request.angular_tolerance), request.max_time > 0 ? request.max_time : 120, path_check,
+                      time_to_reach_results);
+
+    response.success = true;
+    for (const auto &result : time_to_reach_results)
+    {
+      response.arrived.push_back(result.arrived);
+      response.times_to_arrival.push_back(result.time_to_arrival);
+      response.paths_valid.push_back(result.path_valid);
+    }
+    return true;
   }
 
   void odom_callback(const OdometryConstPtr &odom)
   {
     if (c3trajectory)
       return;  // already initialized
-    if (kill_listener.isRaised() || disabled)
+    if (killed || disabled)
       return;  // only initialize when unkilled
 
     ros::Time now = ros::Time::now();
@@ -184,26 +525,387 @@ struct Node
 
     current_waypoint = current;
     current_waypoint_t = now;
+    waypoint_queue.clear();
+  }
+
+  void publish_state()
+  {
+    subjugator::TripleBuffer<TrajectoryState> *buffers[] = { &goal_state, &visualization_state, &preview_state };
+    for (subjugator::TripleBuffer<TrajectoryState> *buffer : buffers)
+    {
+      TrajectoryState &state = buffer->back();
+      state.active = bool(c3trajectory);
+      state.command_seq = applied_command_seq;
+      if (c3trajectory)
+      {
+        state.t = c3trajectory_t;
+        state.trajectory = *c3trajectory;
+        state.waypoint = current_waypoint;
+        state.waypoint_t = current_waypoint_t;
+        state.sequence_index = sequence_index;
+        state.remaining_waypoints = waypoint_queue.size();
+        for (unsigned int i = 0; i < std::min<size_t>(waypoint_queue.size(), TrajectoryState::SPLINE_WAYPOINTS); ++i)
+          state.next_waypoints[i] = waypoint_queue[i];
+        state.blend_radius = blend_radius;
+        state.blend_angular_tolerance = blend_angular_tolerance;
+      }
+      buffer->publish();
+    }
+  }
+
+  // Trajectory thread
+  void timer_callback(const ros::TimerEvent &event)
+  {
+    if (!record_ticks)
+    {
+      update_trajectory();
+      return;
+    }
+
+    TickSample sample;
+    sample.t = ros::WallTime::now();
+    sample.lateness = (event.current_real - event.current_expected).toSec();
+    sample.substeps = update_trajectory();
+    sample.duration = (ros::WallTime::now() - sample.t).toSec();
+    tick_samples.push(sample);
+  }
+
+  // Applies the latest command, integrates up to now and publishes the setpoint. Returns the number of steps taken.
+  unsigned int update_trajectory()
+  {
+    unsigned int substeps = 0;
+    bool new_command = commands.update();
+    if (new_command)
+      killed = commands.front().killed;
+    if (disabled || killed)
+      c3trajectory.reset();  // On revive/enable, wait for odom before station keeping
+
+    if (!c3trajectory)
+    {
+      if (new_command)
+        applied_command_seq = commands.front().seq;  // dropped, the goal thread aborts its goals anyway
+      publish_state();
+      return substeps;
+    }
+
+    ros::Time now = ros::Time::now();
+
+    if (new_command)
+    {
+      TrajectoryCommand &command = commands.front();
+      applied_command_seq = command.seq;
+      if (command.mode == TrajectoryCommand::STOP)
+      {
+        current_waypoint = c3trajectory->getCurrentPoint();
+        current_waypoint.do_waypoint_validation = false;
+        current_waypoint.r.qdot = subjugator::Vector6d::Zero();  // zero velocities
+      }
+      else
+      {
+        current_waypoint = command.waypoint;
+      }
+      current_waypoint_t = now;
+      // Swap rather than copy so the trajectory thread never allocates
+      waypoint_queue.swap(command.queue);
+      blend_radius = command.blend_radius;
+      blend_angular_tolerance = command.blend_angular_tolerance;
+      sequence_index = 0;
+
+      if (command.mode != TrajectoryCommand::MOVE)
+      {
+        // don't try to make output c3 continuous when cancelled - instead stop as quickly as possible
+        c3trajectory.reset(new subjugator::C3Trajectory(current_waypoint.r, limits));
+        c3trajectory_t = now;
+      }
+    }
+
+    const ros::Duration &step = exact_integration ? traj_exact_dt : traj_dt;
+    while (c3trajectory_t + step < now)
+    {
+      double waypoint_t = (c3trajectory_t - current_waypoint_t).toSec();
+      if (exact_integration)
+        c3trajectory->update_exact(step.toSec(), current_waypoint, waypoint_t);
+      else
+        c3trajectory->update(step.toSec(), current_waypoint, waypoint_t);
+      c3trajectory_t += step;
+      if (flight_recorder && c3trajectory_t >= next_flight_record_t)
+      {
+        flight_recorder->record(c3trajectory_t.toSec(), *c3trajectory, current_waypoint, waypoint_t);
+        next_flight_record_t = c3trajectory_t + flight_log_period;
+      }
+      ++substeps;
+
+      // Hand over to the next waypoint of a sequence before stopping at this one
+      if (!waypoint_queue.empty() && c3trajectory->should_blend(current_waypoint, blend_radius, blend_angular_tolerance))
+      {
+        current_waypoint = waypoint_queue.front();
+        waypoint_queue.pop_front();
+        current_waypoint_t = c3trajectory_t;
+        ++sequence_index;
+      }
+    }
+
+    PoseTwistStamped msg;
+    msg.header.stamp = c3trajectory_t;
+    msg.header.frame_id = fixed_frame;
+    msg.posetwist = PoseTwist_from_PointWithAcceleration(c3trajectory->getCurrentPoint());
+    trajectory_pub.publish(msg);
+
+    publish_state();
+    return substeps;
   }
 
-  void timer_callback(const ros::TimerEvent &)
+  // Visualization thread
+  void visualization_callback(const ros::TimerEvent &)
+  {
+    if (!visualization_state.update() || !visualization_state.front().active)
+      return;
+    const TrajectoryState &state = visualization_state.front();
+    subjugator::C3Trajectory::PointWithAcceleration p = state.trajectory->getCurrentPoint();
+
+    waypoint_validity_.pub_size_ogrid(Pose_from_Waypoint(p), 200);
+
+    PoseStamped msgVis;
+    msgVis.header.stamp = state.t;
+    msgVis.header.frame_id = fixed_frame;
+    msgVis.pose = PoseTwist_from_PointWithAcceleration(p).pose;
+    trajectory_vis_pub.publish(msgVis);
+
+    PoseStamped posemsg;
+    posemsg.header.stamp = state.t;
+    posemsg.header.frame_id = fixed_frame;
+    posemsg.pose = Pose_from_Waypoint(state.waypoint);
+    waypoint_pose_pub.publish(posemsg);
+
+    if (trajectory_spline_pub.getNumSubscribers() > 0 &&
+        (state.t >= last_spline_t + spline_period || state.waypoint_t != last_spline_waypoint_t))
+      publish_spline(state);
+  }
+
+  void tick_statistics_callback(const ros::WallTimerEvent &)
+  {
+    size_t dropped = tick_samples.drain(tick_drain);
+    tick_window.insert(tick_window.end(), tick_drain.begin(), tick_drain.end());
+    tick_drain.clear();
+    ros::WallTime start = ros::WallTime::now() - tick_statistics_window;
+    while (!tick_window.empty() && tick_window.front().t < start)
+      tick_window.pop_front();
+
+    record_ticks = tick_statistics_pub.getNumSubscribers() > 0;
+    if (!record_ticks)
+      tick_window.clear();
+    if (tick_window.empty())
+      return;
+
+    TickStatistics msg;
+    msg.header.stamp = ros::Time::now();
+    msg.window = tick_statistics_window.toSec();
+    msg.ticks = tick_window.size();
+    msg.dropped = dropped;
+    msg.percentiles = { 50, 90, 99, 100 };
+    tick_percentiles(&TickSample::duration, msg.percentiles, msg.duration);
+    tick_percentiles(&TickSample::lateness, msg.percentiles, msg.lateness);
+    tick_percentiles(&TickSample::substeps, msg.percentiles, msg.substeps);
+    tick_statistics_pub.publish(msg);
+  }
+
+  // Nearest-rank percentiles of one field of the samples in tick_window
+  void tick_percentiles(double TickSample::*field, const std::vector<double> &percentiles, std::vector<double> &out)
+  {
+    tick_scratch.clear();
+    for (const TickSample &sample : tick_window)
+      tick_scratch.push_back(sample.*field);
+    std::sort(tick_scratch.begin(), tick_scratch.end());
+    for (double p : percentiles)
+    {
+      size_t rank = std::ceil(p / 100 * tick_scratch.size());
+      out.push_back(tick_scratch[std::min(std::max<size_t>(rank, 1), tick_scratch.size()) - 1]);
+    }
+  }
+
+  // Rolls a copy of the trajectory spline_horizon ahead and fits a cubic Hermite piece between every pair of knots.
+  // The copy is integrated exactly at spline_dt rather than at the trajectory thread's step: in fixed mode that step
+  // is 0.1 ms, thousands of steps per spline, while the difference over the horizon is far below a controller's
+  // tracking error. It hands over to the next waypoints of a sequence where the trajectory thread will.
+  void publish_spline(const TrajectoryState &state)
+  {
+    TrajectorySpline msg;
+    msg.header.stamp = state.t;
+    msg.header.frame_id = fixed_frame;
+    int pieces = std::max(1, (int)std::round(spline_horizon.toSec() / spline_knot_period.toSec()));
+    msg.knots.reserve(pieces + 1);
+    msg.coefficients.reserve(24 * pieces);
+
+    subjugator::C3Trajectory lookahead(*state.trajectory);
+    const subjugator::C3Trajectory::Waypoint *waypoint = &state.waypoint;
+    ros::Time waypoint_t = state.waypoint_t;
+    unsigned int next = 0;
+    unsigned int queued = std::min<size_t>(state.remaining_waypoints, TrajectoryState::SPLINE_WAYPOINTS);
+    ros::Time t = state.t;
+    subjugator::C3Trajectory::Point start = lookahead.getCurrentPoint();
+    msg.knots.push_back(0);
+    for (int k = 1; k <= pieces; ++k)
+    {
+      ros::Time knot_t = state.t + spline_knot_period * k;
+      while (t + spline_dt < knot_t)
+      {
+        lookahead.update_exact(spline_dt.toSec(), *waypoint, (t - waypoint_t).toSec());
+        t += spline_dt;
+        if (next < queued && lookahead.should_blend(*waypoint, state.blend_radius, state.blend_angular_tolerance))
+        {
+          waypoint = &state.next_waypoints[next++];
+          waypoint_t = t;
+        }
+      }
+      double h = (t - state.t).toSec() - msg.knots.back();
+      if (h <= 0)
+        continue;  // integration step is longer than the knot period
+
+      subjugator::C3Trajectory::Point end = lookahead.getCurrentPoint();
+      for (int i = 3; i < 6; ++i)
+        end.q(i) = start.q(i) + std::remainder(end.q(i) - start.q(i), 2 * M_PI);
+
+      for (int i = 0; i < 6; ++i)
+      {
+        double dq = end.q(i) - start.q(i);
+        msg.coefficients.push_back(start.q(i));
+        msg.coefficients.push_back(start.qdot(i));
+        msg.coefficients.push_back((3 * dq - (2 * start.qdot(i) + end.qdot(i)) * h) / (h * h));
+        msg.coefficients.push_back((-2 * dq + (start.qdot(i) + end.qdot(i)) * h) / (h * h * h));
+      }
+      msg.knots.push_back((t - state.t).toSec());
+      start = end;
+    }
+
+    trajectory_spline_pub.publish(msg);
+    last_spline_t = state.t;
+    last_spline_waypoint_t = state.waypoint_t;
+  }
+
+  // Goal thread
+  void send_command(TrajectoryCommand::Mode mode, const subjugator::C3Trajectory::Waypoint &waypoint,
+                    const std::deque<subjugator::C3Trajectory::Waypoint> &queue = {}, double blend_radius = 0,
+                    double blend_angular_tolerance = 0)
+  {
+    TrajectoryCommand &command = commands.back();
+    command.seq = ++sent_command_seq;
+    command.mode = mode;
+    command.waypoint = waypoint;
+    command.queue = queue;
+    command.blend_radius = blend_radius;
+    command.blend_angular_tolerance = blend_angular_tolerance;
+    command.killed = kill_raised;
+    commands.publish();
+  }
+
+  void abort_sequence(const std::string &err)
+  {
+    if (sequence_actionserver.isActive())
+    {
+      MoveToSequenceResult result;
+      result.error = err;
+      result.success = false;
+      sequence_actionserver.setAborted(result);
+    }
+  }
+
+  void accept_sequence(const TrajectoryState &state)
+  {
+    boost::shared_ptr<const MoveToSequenceGoal> goal = sequence_actionserver.acceptNewGoal();
+    std::deque<subjugator::C3Trajectory::Waypoint> queue;
+
+    // Reject the whole sequence up front if any waypoint is one a moveto goal would be refused for
+    std::string err = goal->posetwists.empty() ? "empty sequence" : "";
+    for (const auto &posetwist : goal->posetwists)
+    {
+      subjugator::C3Trajectory::Waypoint waypoint(Point_from_PoseTwist(posetwist.pose, posetwist.twist), goal->speed,
+                                                  !goal->uncoordinated, !goal->blind);
+      std::pair<bool, WAYPOINT_ERROR_TYPE> checkWPResult =
+          waypoint_validity_.is_waypoint_valid(Pose_from_Waypoint(waypoint), waypoint.do_waypoint_validation);
+      if (waypoint_check_ && (checkWPResult.second == WAYPOINT_ERROR_TYPE::OCCUPIED ||
+                              checkWPResult.second == WAYPOINT_ERROR_TYPE::ABOVE_WATER))
+      {
+        waypoint_validity_.pub_size_ogrid(Pose_from_Waypoint(waypoint), (int)OGRID_COLOR::RED);
+        err = WAYPOINT_ERROR_TO_STRING.at(checkWPResult.second);
+        break;
+      }
+      queue.push_back(waypoint);
+    }
+    if (!err.empty())
+    {
+      ROS_ERROR_STREAM("can't move through sequence! - " << err);
+      abort_sequence(err);
+      return;
+    }
+
+    subjugator::C3Trajectory::Waypoint first = queue.front();
+    queue.pop_front();
+    double blend_angular_tolerance = max(1e-3, goal->angular_tolerance);
+
+    // The waypoints are clear, check that the footprint swept along every leg is too, as it is for a moveto goal.
+    // The rollout hands over from one waypoint to the next where the trajectory thread will.
+    if (waypoint_check_ && !goal->blind)
+    {
+      validation_rollout_->run(*state.trajectory, first, queue, goal->blend_radius, max(1e-3, goal->linear_tolerance),
+                               blend_angular_tolerance, 0, 120);
+      const auto &samples = validation_rollout_->samples();
+      const auto &handovers = validation_rollout_->handovers();
+      for (size_t leg = 0; leg <= handovers.size(); ++leg)
+      {
+        size_t begin = leg == 0 ? 0 : handovers[leg - 1];
+        size_t end = leg < handovers.size() ? handovers[leg] + 1 : samples.size();
+        validation_path_.clear();
+        for (size_t i = begin; i < end; ++i)
+          validation_path_.push_back(vec2xyz<Point>(samples[i].q.head(3)));
+
+        std::pair<bool, WAYPOINT_ERROR_TYPE> checkTrajResult =
+            waypoint_validity_.is_trajectory_valid(validation_path_, true);
+        if (checkTrajResult.first == false)
+        {
+          err = WAYPOINT_ERROR_TO_STRING.at(checkTrajResult.second);
+          ROS_ERROR_STREAM("can't move through sequence! - trajectory to waypoint " << leg << " is occupied");
+          waypoint_validity_.pub_size_ogrid(Pose_from_Waypoint(leg == 0 ? first : queue[leg - 1]),
+                                            (int)OGRID_COLOR::RED);
+          abort_sequence(err);
+          return;
+        }
+      }
+    }
+
+    send_command(TrajectoryCommand::MOVE, first, queue, goal->blend_radius, blend_angular_tolerance);
+    linear_tolerance = goal->linear_tolerance;
+    angular_tolerance = goal->angular_tolerance;
+    last_sequence_index = 0;
+
+    MoveToSequenceFeedback feedback;
+    feedback.current_index = 0;
+    sequence_actionserver.publishFeedback(feedback);
+  }
+
+  // Goal thread: accepts and validates goals and reports on them, from the latest trajectory state
+  void goal_callback(const ros::TimerEvent &)
   {
     mil_msgs::MoveToResult actionresult;
+    goal_state.update();
+    const TrajectoryState &state = goal_state.front();
+
+    // Tell the trajectory thread as soon as the kill alarm changes, every other command carries it too
+    bool was_raised = kill_raised;
+    kill_raised = kill_listener.isRaised();
+    if (kill_raised != was_raised)
+      send_command(TrajectoryCommand::STOP, state.waypoint);
 
     // Handle disabled, killed, or no odom before attempting to produce trajectory
     std::string err = "";
     if (disabled)
       err = "c3 disabled";
-    else if (kill_listener.isRaised())
+    else if (kill_raised)
       err = "killed";
-    else if (!c3trajectory)
+    else if (!state.active)
       err = "no odom";
 
     if (!err.empty())
     {
-      if (c3trajectory)
-        c3trajectory.reset();  // On revive/enable, wait for odom before station keeping
-
       // Cancel all goals while killed/disabled/no odom
       if (actionserver.isNewGoalAvailable())
         actionserver.acceptNewGoal();
@@ -213,26 +915,28 @@ struct Node
         actionresult.success = false;
         actionserver.setAborted(actionresult);
       }
+      if (sequence_actionserver.isNewGoalAvailable())
+        sequence_actionserver.acceptNewGoal();
+      abort_sequence(err);
       return;
     }
 
-    ros::Time now = ros::Time::now();
-
-    auto old_waypoint = current_waypoint;
+    // Only report on goals once the trajectory thread is working on the latest command
+    bool up_to_date = state.command_seq == sent_command_seq;
+    subjugator::C3Trajectory::PointWithAcceleration current_point = state.trajectory->getCurrentPoint();
 
     if (actionserver.isNewGoalAvailable())
     {
       boost::shared_ptr<const mil_msgs::MoveToGoal> goal = actionserver.acceptNewGoal();
-      current_waypoint =
+      auto old_waypoint = state.waypoint;
+      auto current_waypoint =
           subjugator::C3Trajectory::Waypoint(Point_from_PoseTwist(goal->posetwist.pose, goal->posetwist.twist),
                                              goal->speed, !goal->uncoordinated, !goal->blind);
-      current_waypoint_t = now;
-      this->linear_tolerance = goal->linear_tolerance;
-      this->angular_tolerance = goal->angular_tolerance;
 
       waypoint_validity_.pub_size_ogrid(Pose_from_Waypoint(current_waypoint), (int)OGRID_COLOR::GREEN);
 
       // Check if waypoint is valid
+      bool rejected = false;
       std::pair<bool, WAYPOINT_ERROR_TYPE> checkWPResult = waypoint_validity_.is_waypoint_valid(
           Pose_from_Waypoint(current_waypoint), current_waypoint.do_waypoint_validation);
       actionresult.error = WAYPOINT_ERROR_TO_STRING.at(checkWPResult.second);
@@ -249,109 +953,143 @@ struct Node
           if (abs(a_point.position.x - b_point.position.x) > .5 || abs(a_point.position.y - b_point.position.y) > .5)
           {
             ROS_ERROR("can't move there! - need to rotate");
-            current_waypoint = old_waypoint;
+            rejected = true;
           }
         }
         // if point is occupied, reject move
         if (checkWPResult.second == WAYPOINT_ERROR_TYPE::OCCUPIED)
         {
           ROS_ERROR("can't move there! - waypoint is occupied");
-          current_waypoint = old_waypoint;
+          rejected = true;
         }
         // if point is above water, reject move
         if (checkWPResult.second == WAYPOINT_ERROR_TYPE::ABOVE_WATER)
         {
           ROS_ERROR("can't move there! - waypoint is above water");
-          current_waypoint = old_waypoint;
+          rejected = true;
         }
         if (checkWPResult.second == WAYPOINT_ERROR_TYPE::NO_OGRID)
         {
           ROS_ERROR("WaypointValidity - Did not recieve any ogrid");
         }
       }
+      else if (waypoint_check_ && current_waypoint.do_waypoint_validation)
+      {
+        // The endpoint is clear, check that the footprint swept on the way there is too
+        validation_rollout_->run(*state.trajectory, current_waypoint, max(1e-3, goal->linear_tolerance),
+                                 max(1e-3, goal->angular_tolerance), 0, 120);
+        validation_path_.clear();
+        for (const auto &p : validation_rollout_->samples())
+          validation_path_.push_back(vec2xyz<Point>(p.q.head(3)));
+
+        std::pair<bool, WAYPOINT_ERROR_TYPE> checkTrajResult =
+            waypoint_validity_.is_trajectory_valid(validation_path_, true);
+        if (checkTrajResult.first == false)
+        {
+          ROS_ERROR("can't move there! - trajectory passes through an occupied area");
+          waypoint_validity_.pub_size_ogrid(Pose_from_Waypoint(current_waypoint), (int)OGRID_COLOR::RED);
+          actionresult.error = WAYPOINT_ERROR_TO_STRING.at(checkTrajResult.second);
+          actionresult.success = false;
+          rejected = true;
+        }
+      }
+      // A rejected goal is aborted and leaves the trajectory (and any sequence) exactly as it was
+      if (rejected)
+      {
+        actionresult.success = false;
+        actionserver.setAborted(actionresult);
+      }
+      else
+      {
+        abort_sequence("preempted by a moveto goal");
+        linear_tolerance = goal->linear_tolerance;
+        angular_tolerance = goal->angular_tolerance;
+        send_command(TrajectoryCommand::MOVE, current_waypoint);
+        up_to_date = false;
+      }
     }
-    if (actionserver.isPreemptRequested())
+    if (sequence_actionserver.isNewGoalAvailable())
     {
-      current_waypoint = c3trajectory->getCurrentPoint();
-      current_waypoint.do_waypoint_validation = false;
-      current_waypoint.r.qdot = subjugator::Vector6d::Zero();  // zero velocities
-      current_waypoint_t = now;
-
-      // don't try to make output c3 continuous when cancelled - instead stop as quickly as possible
-      c3trajectory.reset(new subjugator::C3Trajectory(current_waypoint.r, limits));
-      c3trajectory_t = now;
+      if (actionserver.isActive())
+      {
+        actionresult.error = "preempted by a moveto_sequence goal";
+        actionresult.success = false;
+        actionserver.setAborted(actionresult);
+      }
+      accept_sequence(state);
+      up_to_date = false;
     }
-
-    // Remember the previous trajectory
-    auto old_trajectory = c3trajectory->getCurrentPoint();
-
-    while (c3trajectory_t + traj_dt < now)
+    if (actionserver.isPreemptRequested() || sequence_actionserver.isPreemptRequested())
     {
-      c3trajectory->update(traj_dt.toSec(), current_waypoint, (c3trajectory_t - current_waypoint_t).toSec());
-      c3trajectory_t += traj_dt;
+      send_command(TrajectoryCommand::STOP, state.waypoint);
+      up_to_date = false;
+      if (sequence_actionserver.isPreemptRequested())
+        sequence_actionserver.setPreempted();
     }
 
     // Check if we will hit something while in trajectory the new trajectory
-    geometry_msgs::Pose traj_point;  // Convert messages to correct type
-    auto p = c3trajectory->getCurrentPoint();
-    traj_point.position = vec2xyz<Point>(p.q.head(3));
-    quaternionTFToMsg(tf::createQuaternionFromRPY(p.q[3], p.q[4], p.q[5]), traj_point.orientation);
-
     std::pair<bool, WAYPOINT_ERROR_TYPE> checkWPResult =
-        waypoint_validity_.is_waypoint_valid(Pose_from_Waypoint(p), c3trajectory->do_waypoint_validation);
+        waypoint_validity_.is_waypoint_valid(Pose_from_Waypoint(current_point), state.trajectory->do_waypoint_validation);
 
-    if (checkWPResult.first == false && checkWPResult.second == WAYPOINT_ERROR_TYPE::OCCUPIED && waypoint_check_)
+    if (up_to_date && checkWPResult.first == false && checkWPResult.second == WAYPOINT_ERROR_TYPE::OCCUPIED &&
+        waypoint_check_)
     {  // New trajectory will hit an occupied goal, so reject
       ROS_ERROR("can't move there! - bad trajectory");
-      current_waypoint = old_trajectory;
-      current_waypoint.do_waypoint_validation = false;
-      current_waypoint.r.qdot = subjugator::Vector6d::Zero();  // zero velocities
-      current_waypoint_t = now;
-
-      c3trajectory.reset(new subjugator::C3Trajectory(current_waypoint.r, limits));
-      c3trajectory_t = now;
+      subjugator::C3Trajectory::Waypoint stop_waypoint = last_trajectory_point;
+      stop_waypoint.do_waypoint_validation = false;
+      stop_waypoint.r.qdot = subjugator::Vector6d::Zero();  // zero velocities
+      send_command(TrajectoryCommand::RESTART, stop_waypoint);
+      up_to_date = false;
       actionresult.success = false;
       actionresult.error = WAYPOINT_ERROR_TO_STRING.at(WAYPOINT_ERROR_TYPE::OCCUPIED_TRAJECTORY);
+      abort_sequence(actionresult.error);
     }
+    // Remember the previous trajectory
+    last_trajectory_point = current_point;
 
-    PoseTwistStamped msg;
-    msg.header.stamp = c3trajectory_t;
-    msg.header.frame_id = fixed_frame;
-    msg.posetwist = PoseTwist_from_PointWithAcceleration(c3trajectory->getCurrentPoint());
-    trajectory_pub.publish(msg);
-
-    waypoint_validity_.pub_size_ogrid(Pose_from_Waypoint(c3trajectory->getCurrentPoint()), 200);
-
-    PoseStamped msgVis;
-    msgVis.header = msg.header;
-    msgVis.pose = msg.posetwist.pose;
-    trajectory_vis_pub.publish(msgVis);
+    if (!up_to_date)
+      return;
 
-    PoseStamped posemsg;
-    posemsg.header.stamp = c3trajectory_t;
-    posemsg.header.frame_id = fixed_frame;
-    posemsg.pose = Pose_from_Waypoint(current_waypoint);
-    waypoint_pose_pub.publish(posemsg);
+    if (sequence_actionserver.isActive() && state.sequence_index != last_sequence_index)
+    {
+      last_sequence_index = state.sequence_index;
+      MoveToSequenceFeedback feedback;
+      feedback.current_index = state.sequence_index;
+      sequence_actionserver.publishFeedback(feedback);
+    }
 
-    if (actionserver.isActive() &&
-        c3trajectory->getCurrentPoint().is_approximately(current_waypoint.r, max(1e-3, linear_tolerance),
-                                                         max(1e-3, angular_tolerance)) &&
-        current_waypoint.r.qdot == subjugator::Vector6d::Zero())
+    bool arrived = current_point.is_approximately(state.waypoint.r, max(1e-3, linear_tolerance),
+                                                  max(1e-3, angular_tolerance)) &&
+                   state.waypoint.r.qdot == subjugator::Vector6d::Zero();
+    if (actionserver.isActive() && arrived)
     {
       actionresult.error = "";
       actionresult.success = true;
       actionserver.setSucceeded(actionresult);
     }
+    if (sequence_actionserver.isActive() && arrived && state.remaining_waypoints == 0)
+    {
+      MoveToSequenceResult result;
+      result.error = "";
+      result.success = true;
+      sequence_actionserver.setSucceeded(result);
+    }
   }
 };
 
-int main(int argc, char **argv)
+namespace c3_trajectory_generator
 {
-  ros::init(argc, argv, "c3_trajectory_generator");
-
-  Node n;
-
-  ros::spin();
+// Runs the node inside a nodelet manager, so ogrids from a perception nodelet in the same manager arrive as shared
+// pointers instead of being serialized. The c3_trajectory_generator executable loads it standalone.
+class C3TrajectoryGeneratorNodelet : public nodelet::Nodelet
+{
+  boost::scoped_ptr<Node> node;
 
-  return 0;
+  void onInit() override
+  {
+    node.reset(new Node(getNodeHandle(), getPrivateNodeHandle()));
+  }
+};
 }
+
+PLUGINLIB_EXPORT_CLASS(c3_trajectory_generator::C3TrajectoryGeneratorNodelet, nodelet::Nodelet)
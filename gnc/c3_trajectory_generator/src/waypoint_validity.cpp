@@ -1,31 +1,198 @@
 #include "waypoint_validity.hpp"
 
-// Point and sub_size must be relative to ogrid (IE, in ogrid-cell units)
-bool WaypointValidity::check_if_hit(cv::Point center, cv::Size sub_size)
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <limits>
+#include <vector>
+
+OgridTables::OgridTables(const nav_msgs::OccupancyGridConstPtr &ogrid) : ogrid(ogrid), stamp(ogrid->header.stamp)
+{
+  occupied = cv::Mat::zeros(ogrid->info.height + 1, ogrid->info.width + 1, CV_32S);
+  unknown = cv::Mat::zeros(ogrid->info.height + 1, ogrid->info.width + 1, CV_32S);
+  if (ogrid->data.size() != size_t(ogrid->info.width) * ogrid->info.height)
+    return;
+  patch_table(occupied, (int8_t)WAYPOINT_ERROR_TYPE::OCCUPIED, 0, 0, ogrid->info.width, ogrid->info.height,
+              ogrid->data.data());
+  patch_table(unknown, (int8_t)WAYPOINT_ERROR_TYPE::UNKNOWN, 0, 0, ogrid->info.width, ogrid->info.height,
+              ogrid->data.data());
+}
+
+OgridTables::OgridTables(const OgridTables &other)
+  : ogrid(other.ogrid), stamp(other.stamp), occupied(other.occupied.clone()), unknown(other.unknown.clone())
+{
+}
+
+void OgridTables::patch(const c3_trajectory_generator::OgridUpdate &update)
 {
-  for (int x = center.x - sub_size.width / 2; x < center.x + sub_size.width / 2; ++x)
+  patch_table(occupied, (int8_t)WAYPOINT_ERROR_TYPE::OCCUPIED, update.x, update.y, update.width, update.height,
+              update.data.data());
+  patch_table(unknown, (int8_t)WAYPOINT_ERROR_TYPE::UNKNOWN, update.x, update.y, update.width, update.height,
+              update.data.data());
+  stamp = update.header.stamp;
+}
+
+// Rows above y keep their sums. Each row from y down is its new prefix sum added to the new row above it, and the
+// cells outside of the update are recovered from the old table, two rows of which are kept as they were.
+void OgridTables::patch_table(cv::Mat &table, int8_t value, int x, int y, int width, int height, const int8_t *data)
+{
+  const int cols = table.cols - 1;
+  std::vector<int> old_above(table.ptr<int>(y), table.ptr<int>(y) + cols + 1);
+  std::vector<int> old_row(cols + 1);
+  for (int r = y; r < table.rows - 1; ++r)
   {
-    for (int y = center.y - sub_size.height / 2; y < center.y + sub_size.height / 2; ++y)
+    int *row = table.ptr<int>(r + 1);
+    const int *above = table.ptr<int>(r);
+    std::copy(row, row + cols + 1, old_row.begin());
+    const bool patched = r < y + height;
+    int run = 0;
+    for (int c = 0; c < cols; ++c)
     {
-      try
-      {
-        if (ogrid_map_->data.at(x + y * ogrid_map_->info.width) == (uchar)WAYPOINT_ERROR_TYPE::OCCUPIED)
-        {
-          return true;
-        }
-      }
-      catch (std::out_of_range &e)
-      {
-        return true;
-      }
+      if (patched && c >= x && c < x + width)
+        run += data[(r - y) * width + c - x] == value;
+      else
+        run += old_row[c + 1] - old_above[c + 1] - old_row[c] + old_above[c];
+      row[c + 1] = above[c + 1] + run;
     }
+    old_above.swap(old_row);
   }
-  return false;
+}
+
+OgridTables::Counts OgridTables::count(int x0, int y0, int x1, int y1) const
+{
+  int width = ogrid->info.width;
+  int height = ogrid->info.height;
+  int area = std::max(0, x1 - x0) * std::max(0, y1 - y0);
+  x0 = std::min(std::max(x0, 0), width);
+  x1 = std::min(std::max(x1, x0), width);
+  y0 = std::min(std::max(y0, 0), height);
+  y1 = std::min(std::max(y1, y0), height);
+
+  auto sum = [&](const cv::Mat &table) {
+    return table.at<int>(y1, x1) - table.at<int>(y0, x1) - table.at<int>(y1, x0) + table.at<int>(y0, x0);
+  };
+  Counts counts;
+  counts.occupied = sum(occupied);
+  counts.unknown = sum(unknown);
+  counts.outside = area - (x1 - x0) * (y1 - y0);
+  return counts;
+}
+
+bool OgridTables::is_occupied(int x0, int y0, int x1, int y1) const
+{
+  Counts counts = count(x0, y0, x1, y1);
+  return counts.occupied > 0 || counts.outside > 0;
+}
+
+// Point and sub_size must be relative to ogrid (IE, in ogrid-cell units)
+bool WaypointValidity::check_if_hit(const OgridTables &ogrid, cv::Point center, cv::Size sub_size)
+{
+  return ogrid.is_occupied(center.x - sub_size.width / 2, center.y - sub_size.height / 2,
+                           center.x + sub_size.width / 2, center.y + sub_size.height / 2);
+}
+
+// The footprint covers [center - size / 2, center + size / 2), same as check_if_hit. After the center moves
+// by one cell only a single row or column enters it.
+bool WaypointValidity::check_if_hit_edge(const OgridTables &ogrid, cv::Point center, cv::Size sub_size, int dx, int dy)
+{
+  if (dx != 0)
+  {
+    int x = dx > 0 ? center.x + sub_size.width / 2 - 1 : center.x - sub_size.width / 2;
+    return ogrid.is_occupied(x, center.y - sub_size.height / 2, x + 1, center.y + sub_size.height / 2);
+  }
+  int y = dy > 0 ? center.y + sub_size.height / 2 - 1 : center.y - sub_size.height / 2;
+  return ogrid.is_occupied(center.x - sub_size.width / 2, y, center.x + sub_size.width / 2, y + 1);
+}
+
+bool WaypointValidity::edge_leaves_ogrid(const OgridTables &ogrid, cv::Point center, cv::Size sub_size, int dx, int dy)
+{
+  if (dx != 0)
+  {
+    int x = dx > 0 ? center.x + sub_size.width / 2 - 1 : center.x - sub_size.width / 2;
+    return ogrid.count(x, center.y - sub_size.height / 2, x + 1, center.y + sub_size.height / 2).outside > 0;
+  }
+  int y = dy > 0 ? center.y + sub_size.height / 2 - 1 : center.y - sub_size.height / 2;
+  return ogrid.count(center.x - sub_size.width / 2, y, center.x + sub_size.width / 2, y + 1).outside > 0;
+}
+
+void WaypointValidity::footprint_half_extents(const geometry_msgs::Pose &pose, double length, double width,
+                                              double &half_x, double &half_y)
+{
+  const geometry_msgs::Quaternion &q = pose.orientation;
+  double yaw = std::atan2(2 * (q.w * q.z + q.x * q.y), 1 - 2 * (q.y * q.y + q.z * q.z));
+  half_x = (std::abs(std::cos(yaw)) * length + std::abs(std::sin(yaw)) * width) / 2;
+  half_y = (std::abs(std::sin(yaw)) * length + std::abs(std::cos(yaw)) * width) / 2;
+}
+
+size_t WaypointValidity::count_footprint_voxels(const subjugator::VoxelMap &voxels, const geometry_msgs::Pose &pose,
+                                                double length, double width, double height)
+{
+  double half_x, half_y;
+  footprint_half_extents(pose, length, width, half_x, half_y);
+  const geometry_msgs::Point &p = pose.position;
+  return voxels.count_in_box(p.x - half_x, p.y - half_y, p.z - height / 2, p.x + half_x, p.y + half_y,
+                             p.z + height / 2);
 }
 
 void WaypointValidity::ogrid_callback(const nav_msgs::OccupancyGridConstPtr &ogrid_map)
 {
-  this->ogrid_map_ = ogrid_map;
+  current_.reset(new OgridTables(ogrid_map));
+  spare_.reset();
+  spare_missing_.reset();
+  // Atomic so is_trajectory_valid can take its own reference from another thread
+  boost::atomic_store(&this->ogrid_, boost::shared_ptr<const OgridTables>(current_));
+}
+
+void WaypointValidity::ogrid_update_callback(const c3_trajectory_generator::OgridUpdateConstPtr &update)
+{
+  if (!current_)
+    return;
+  // An update to the ogrid before the last one, or to one that hasn't arrived yet
+  if (update->keyframe != current_->ogrid->header.stamp)
+  {
+    ROS_DEBUG_THROTTLE(1, "Ignoring ogrid update to another ogrid");
+    return;
+  }
+  // Late, from before the last update
+  if (update->header.stamp <= current_->stamp)
+  {
+    ROS_DEBUG_THROTTLE(1, "Ignoring ogrid update that is older than the last one");
+    return;
+  }
+  const nav_msgs::MapMetaData &info = current_->ogrid->info;
+  if (update->x < 0 || update->y < 0 || update->x + update->width > info.width ||
+      update->y + update->height > info.height || update->data.size() != update->width * update->height)
+  {
+    ROS_WARN_THROTTLE(1, "Ignoring ogrid update that does not fit the last ogrid");
+    return;
+  }
+
+  boost::shared_ptr<OgridTables> next;
+  if (spare_ && spare_.unique())
+  {
+    // Whatever the last thread to hold spare_ read from it happened before it let go
+    std::atomic_thread_fence(std::memory_order_acquire);
+    next.swap(spare_);
+    next->patch(*spare_missing_);
+  }
+  else
+  {
+    next.reset(new OgridTables(*current_));
+  }
+  next->patch(*update);
+
+  spare_.swap(current_);
+  spare_missing_ = update;
+  current_ = next;
+  boost::atomic_store(&this->ogrid_, boost::shared_ptr<const OgridTables>(current_));
+}
+
+void WaypointValidity::voxels_callback(const c3_trajectory_generator::OccupiedVoxelsConstPtr &msg)
+{
+  boost::shared_ptr<subjugator::VoxelMap> voxels(new subjugator::VoxelMap(msg->resolution));
+  for (size_t i = 0; i + 2 < msg->indices.size(); i += 3)
+    voxels->add_voxel(msg->indices[i], msg->indices[i + 1], msg->indices[i + 2]);
+  boost::atomic_store(&this->voxels_, boost::shared_ptr<const subjugator::VoxelMap>(voxels));
 }
 
 // Convert waypoint to be relative to ogrid, then do a series of checks (unknown, occupied, or above water).
@@ -40,54 +207,200 @@ std::pair<bool, WAYPOINT_ERROR_TYPE> WaypointValidity::is_waypoint_valid(const g
     return std::make_pair(false, WAYPOINT_ERROR_TYPE::ABOVE_WATER);
   }
 
-  if (!this->ogrid_map_)
+  boost::shared_ptr<const OgridTables> ogrid = boost::atomic_load(&this->ogrid_);
+  if (!ogrid)
   {
     return std::make_pair(false, WAYPOINT_ERROR_TYPE::NO_OGRID);
   }
+  const nav_msgs::OccupancyGrid &ogrid_map = *ogrid->ogrid;
 
-  cv::Point center_of_ogrid =
-      cv::Point(ogrid_map_->info.origin.position.x, ogrid_map_->info.origin.position.y) +
-      cv::Point(ogrid_map_->info.width, ogrid_map_->info.height) * ogrid_map_->info.resolution / 2;
+  cv::Point center_of_ogrid = cv::Point(ogrid_map.info.origin.position.x, ogrid_map.info.origin.position.y) +
+                              cv::Point(ogrid_map.info.width, ogrid_map.info.height) * ogrid_map.info.resolution / 2;
   cv::Point where_sub =
-      cv::Point((waypoint.position.x - center_of_ogrid.x) / ogrid_map_->info.resolution + ogrid_map_->info.width / 2,
-                (waypoint.position.y - center_of_ogrid.y) / ogrid_map_->info.resolution + ogrid_map_->info.height / 2);
+      cv::Point((waypoint.position.x - center_of_ogrid.x) / ogrid_map.info.resolution + ogrid_map.info.width / 2,
+                (waypoint.position.y - center_of_ogrid.y) / ogrid_map.info.resolution + ogrid_map.info.height / 2);
 
   // Area we want to check around the sub
-  int sub_x = sub_ogrid_size_ / ogrid_map_->info.resolution;
-  int sub_y = sub_ogrid_size_ / ogrid_map_->info.resolution;
+  int sub_x = sub_ogrid_size_ / ogrid_map.info.resolution;
+  int sub_y = sub_ogrid_size_ / ogrid_map.info.resolution;
 
-  if (check_if_hit(where_sub, cv::Size(sub_x, sub_y)))
+  // With voxels only what is at the waypoint's depth counts as occupied, but leaving the ogrid still does
+  boost::shared_ptr<const subjugator::VoxelMap> voxels;
+  if (use_voxels_)
+    voxels = boost::atomic_load(&this->voxels_);
+  bool hit;
+  if (voxels)
   {
-    return std::make_pair(false, WAYPOINT_ERROR_TYPE::OCCUPIED);
+    OgridTables::Counts footprint = ogrid->count(where_sub.x - sub_x / 2, where_sub.y - sub_y / 2,
+                                                 where_sub.x + sub_x / 2, where_sub.y + sub_y / 2);
+    hit = footprint.outside > 0 ||
+          count_footprint_voxels(*voxels, waypoint, sub_ogrid_size_, sub_ogrid_size_, sub_height_) > 0;
   }
-  try
+  else
+    hit = check_if_hit(*ogrid, where_sub, cv::Size(sub_x, sub_y));
+  if (hit)
   {
-    if (ogrid_map_->data.at(where_sub.x + where_sub.y * ogrid_map_->info.width) == (uchar)WAYPOINT_ERROR_TYPE::UNKNOWN)
-    {
-      return std::make_pair(false, WAYPOINT_ERROR_TYPE::UNKNOWN);
-    }
+    return std::make_pair(false, WAYPOINT_ERROR_TYPE::OCCUPIED);
   }
-  catch (std::out_of_range &e)
+  OgridTables::Counts center = ogrid->count(where_sub.x, where_sub.y, where_sub.x + 1, where_sub.y + 1);
+  if (center.outside > 0)
   {
     return std::make_pair(false, WAYPOINT_ERROR_TYPE::OCCUPIED);
   }
+  if (center.unknown > 0)
+  {
+    return std::make_pair(false, WAYPOINT_ERROR_TYPE::UNKNOWN);
+  }
+
+  return std::make_pair(true, WAYPOINT_ERROR_TYPE::UNOCCUPIED);
+}
+
+bool WaypointValidity::get_footprint_counts(const geometry_msgs::Pose &pose, double length, double width,
+                                            OgridTables::Counts &counts)
+{
+  boost::shared_ptr<const OgridTables> ogrid = boost::atomic_load(&this->ogrid_);
+  if (!ogrid)
+    return false;
+  const nav_msgs::MapMetaData &info = ogrid->ogrid->info;
+
+  double half_x, half_y;
+  footprint_half_extents(pose, length, width, half_x, half_y);
+
+  double x = (pose.position.x - info.origin.position.x) / info.resolution;
+  double y = (pose.position.y - info.origin.position.y) / info.resolution;
+  double half_x_cells = half_x / info.resolution;
+  double half_y_cells = half_y / info.resolution;
+  counts = ogrid->count(std::floor(x - half_x_cells), std::floor(y - half_y_cells), std::ceil(x + half_x_cells),
+                        std::ceil(y + half_y_cells));
+  return true;
+}
+
+bool WaypointValidity::get_footprint_voxels(const geometry_msgs::Pose &pose, double length, double width,
+                                            double height, size_t &occupied)
+{
+  boost::shared_ptr<const subjugator::VoxelMap> voxels = boost::atomic_load(&this->voxels_);
+  if (!voxels)
+    return false;
+  occupied = count_footprint_voxels(*voxels, pose, length, width, height);
+  return true;
+}
+
+// Occupied voxels in the sub's box around p that were not already in its box around start
+static size_t count_new_voxels(const subjugator::VoxelMap &voxels, const geometry_msgs::Point &p,
+                               const geometry_msgs::Point &start, double size, double height)
+{
+  double x0 = p.x - size / 2, y0 = p.y - size / 2, z0 = p.z - height / 2;
+  double x1 = p.x + size / 2, y1 = p.y + size / 2, z1 = p.z + height / 2;
+  return voxels.count_in_box(x0, y0, z0, x1, y1, z1) -
+         voxels.count_in_box(std::max(x0, start.x - size / 2), std::max(y0, start.y - size / 2),
+                             std::max(z0, start.z - height / 2), std::min(x1, start.x + size / 2),
+                             std::min(y1, start.y + size / 2), std::min(z1, start.z + height / 2));
+}
+
+// Walk the cells under the path with a grid traversal (Amanatides & Woo) and only check the footprint edge that
+// enters each time the center crosses into a new cell. Cells already under the footprint at the start of the path
+// are not checked, so the sub can always move away from something it is already next to. With voxels, as for
+// waypoints, leaving the ogrid is still checked on the edge, but what is occupied is the voxels in the sub's box at
+// the path's depth where it crosses into each cell, less those already in its box at the start.
+std::pair<bool, WAYPOINT_ERROR_TYPE> WaypointValidity::is_trajectory_valid(const std::vector<geometry_msgs::Point> &path,
+                                                                           bool do_waypoint_validation)
+{
+  if (!do_waypoint_validation)
+    return std::make_pair(true, WAYPOINT_ERROR_TYPE::NOT_CHECKED);
+  boost::shared_ptr<const OgridTables> ogrid = boost::atomic_load(&this->ogrid_);
+  if (!ogrid)
+    return std::make_pair(false, WAYPOINT_ERROR_TYPE::NO_OGRID);
+  boost::shared_ptr<const subjugator::VoxelMap> voxels;
+  if (use_voxels_)
+    voxels = boost::atomic_load(&this->voxels_);
+  const nav_msgs::OccupancyGridConstPtr &ogrid_map = ogrid->ogrid;
+  if (path.empty())
+    return std::make_pair(true, WAYPOINT_ERROR_TYPE::UNOCCUPIED);
+
+  const double resolution = ogrid_map->info.resolution;
+  cv::Point center_of_ogrid =
+      cv::Point(ogrid_map->info.origin.position.x, ogrid_map->info.origin.position.y) +
+      cv::Point(ogrid_map->info.width, ogrid_map->info.height) * resolution / 2;
+  auto to_cells = [&](const geometry_msgs::Point &p) {
+    return cv::Point2d((p.x - center_of_ogrid.x) / resolution + ogrid_map->info.width / 2,
+                       (p.y - center_of_ogrid.y) / resolution + ogrid_map->info.height / 2);
+  };
+
+  int sub_cells = sub_ogrid_size_ / resolution;
+  cv::Size sub_size(sub_cells, sub_cells);
+
+  cv::Point2d from = to_cells(path.front());
+  cv::Point cell(std::floor(from.x), std::floor(from.y));
+  for (size_t i = 1; i < path.size(); ++i)
+  {
+    const geometry_msgs::Point &segment_start = path[i - 1];
+    cv::Point2d to = to_cells(path[i]);
+    cv::Point end(std::floor(to.x), std::floor(to.y));
+    cv::Point2d dir = to - from;
+
+    int step_x = dir.x > 0 ? 1 : -1;
+    int step_y = dir.y > 0 ? 1 : -1;
+    // Distance along the segment (as a fraction of it) to the next cell boundary, and between boundaries
+    double t_delta_x = dir.x != 0 ? std::abs(1 / dir.x) : std::numeric_limits<double>::infinity();
+    double t_delta_y = dir.y != 0 ? std::abs(1 / dir.y) : std::numeric_limits<double>::infinity();
+    double t_max_x = dir.x != 0 ? ((step_x > 0 ? cell.x + 1 : cell.x) - from.x) / dir.x :
+                                  std::numeric_limits<double>::infinity();
+    double t_max_y = dir.y != 0 ? ((step_y > 0 ? cell.y + 1 : cell.y) - from.y) / dir.y :
+                                  std::numeric_limits<double>::infinity();
+
+    while (cell != end && std::min(t_max_x, t_max_y) <= 1)
+    {
+      int dx = 0, dy = 0;
+      double t = std::min(t_max_x, t_max_y);
+      if (t_max_x < t_max_y)
+      {
+        dx = step_x;
+        t_max_x += t_delta_x;
+      }
+      else
+      {
+        dy = step_y;
+        t_max_y += t_delta_y;
+      }
+      cell += cv::Point(dx, dy);
+      if (!voxels)
+      {
+        if (check_if_hit_edge(*ogrid, cell, sub_size, dx, dy))
+          return std::make_pair(false, WAYPOINT_ERROR_TYPE::OCCUPIED_TRAJECTORY);
+        continue;
+      }
+
+      if (edge_leaves_ogrid(*ogrid, cell, sub_size, dx, dy))
+        return std::make_pair(false, WAYPOINT_ERROR_TYPE::OCCUPIED_TRAJECTORY);
+      geometry_msgs::Point p;
+      p.x = segment_start.x + t * (path[i].x - segment_start.x);
+      p.y = segment_start.y + t * (path[i].y - segment_start.y);
+      p.z = segment_start.z + t * (path[i].z - segment_start.z);
+      if (count_new_voxels(*voxels, p, path.front(), sub_ogrid_size_, sub_height_) > 0)
+        return std::make_pair(false, WAYPOINT_ERROR_TYPE::OCCUPIED_TRAJECTORY);
+    }
+    from = to;
+  }
 
   return std::make_pair(true, WAYPOINT_ERROR_TYPE::UNOCCUPIED);
 }
 
 void WaypointValidity::pub_size_ogrid(const geometry_msgs::Pose &waypoint, int d)
 {
-  if (!this->ogrid_map_)
+  // Also called from the visualization thread, so take a reference rather than reading the member directly
+  boost::shared_ptr<const OgridTables> ogrid = boost::atomic_load(&this->ogrid_);
+  if (!ogrid)
     return;
-  std::vector<int8_t> sub_ogrid_data(std::pow(sub_ogrid_size_ / ogrid_map_->info.resolution, 2), d);
+  const nav_msgs::OccupancyGridConstPtr &ogrid_map = ogrid->ogrid;
+  std::vector<int8_t> sub_ogrid_data(std::pow(sub_ogrid_size_ / ogrid_map->info.resolution, 2), d);
   nav_msgs::OccupancyGrid rosGrid;
   rosGrid.header.seq = 0;
-  rosGrid.info.resolution = ogrid_map_->info.resolution;
+  rosGrid.info.resolution = ogrid_map->info.resolution;
   rosGrid.header.frame_id = "map";
   rosGrid.header.stamp = ros::Time::now();
   rosGrid.info.map_load_time = ros::Time::now();
-  rosGrid.info.width = sub_ogrid_size_ / ogrid_map_->info.resolution;
-  rosGrid.info.height = sub_ogrid_size_ / ogrid_map_->info.resolution;
+  rosGrid.info.width = sub_ogrid_size_ / ogrid_map->info.resolution;
+  rosGrid.info.height = sub_ogrid_size_ / ogrid_map->info.resolution;
   rosGrid.info.origin.position.x = waypoint.position.x - sub_ogrid_size_ / 2;
   rosGrid.info.origin.position.y = waypoint.position.y - sub_ogrid_size_ / 2;
   rosGrid.data = sub_ogrid_data;
@@ -102,7 +415,13 @@ WaypointValidity::WaypointValidity(ros::NodeHandle &nh)
   nh_ = &nh;
   sub_ = nh_->subscribe<nav_msgs::OccupancyGrid>("/ogrid_pointcloud/ogrid", 1,
                                                  boost::bind(&WaypointValidity::ogrid_callback, this, _1));
+  update_sub_ = nh_->subscribe<c3_trajectory_generator::OgridUpdate>(
+      "/ogrid_pointcloud/ogrid_deltas", 10, boost::bind(&WaypointValidity::ogrid_update_callback, this, _1));
+  voxel_sub_ = nh_->subscribe<c3_trajectory_generator::OccupiedVoxels>(
+      "/ogrid_pointcloud/voxels", 1, boost::bind(&WaypointValidity::voxels_callback, this, _1));
   nh_->param<double>("sub_ogrid_size", sub_ogrid_size_, 1.5);
+  nh_->param<double>("sub_height", sub_height_, 0.6);
+  nh_->param<bool>("use_voxels", use_voxels_, false);
   pub_waypoint_ogrid_ = nh_->advertise<nav_msgs::OccupancyGrid>("/c3_trajectory_generator/waypoint_ogrid", 1, true);
   pub_sub_ogrid_ = nh_->advertise<nav_msgs::OccupancyGrid>("/c3_trajectory_generator/sub_ogrid", 1, true);
 }
\ No newline at end of file
@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+
+#include "C3Rollout.h"
+#include "c3_scenarios.h"
+
+using namespace subjugator;
+
+// Prints ns per c3filter call with each kernel, then ns per C3Trajectory update and ms per full rollout for each
+// scenario, in both integration modes and with both c3filter kernels. Run against a Release (-O3) build:
+//   rosrun c3_trajectory_generator c3_trajectory_benchmark
+
+typedef std::chrono::steady_clock Clock;
+
+static double elapsed(const Clock::time_point &start)
+{
+  return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+static void benchmark_update(const C3Scenario &scenario, bool exact, bool scalar_filter, double dt)
+{
+  C3Trajectory::Limits limits = c3_scenario_limits();
+  int steps = scenario.duration / dt;
+  int repeats = std::max(1, int(2e6 / steps));
+
+  double best = 1e9;
+  for (int r = 0; r < repeats; r++)
+  {
+    C3Trajectory trajectory(scenario.start, limits);
+    trajectory.use_scalar_filter = scalar_filter;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < steps; i++)
+    {
+      if (exact)
+        trajectory.update_exact(dt, scenario.waypoint, i * dt);
+      else
+        trajectory.update(dt, scenario.waypoint, i * dt);
+    }
+    best = std::min(best, elapsed(start));
+    // Keep the result alive so the loop can't be optimized away
+    volatile double sink = trajectory.getCurrentPoint().q(0);
+    (void)sink;
+  }
+
+  std::printf("  update %-6s %-10s %8.1f ns\n", exact ? "exact" : "fixed", scalar_filter ? "scalar" : "vectorized",
+              1e9 * best / steps);
+}
+
+// Both kernels on the same random inputs, so the filter's own cost isn't hidden by the rest of the update
+static void benchmark_filter(bool scalar_filter)
+{
+  typedef C3Trajectory::Array Array;
+  C3Trajectory::Limits limits = c3_scenario_limits();
+  Array vmin = limits.vmin_b.array(), vmax = limits.vmax_b.array();
+  Array amin = limits.amin_b.array(), amax = limits.amax_b.array();
+  Array umax = limits.umax_b.array(), zero = Array::Zero();
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> distribution(-2, 2);
+  std::vector<Array, Eigen::aligned_allocator<Array> > inputs(5 * 4096);
+  for (Array &input : inputs)
+    for (int i = 0; i < 6; i++)
+      input(i) = distribution(rng);
+
+  double best = 1e9;
+  for (int r = 0; r < 20; r++)
+  {
+    Array sum = zero;
+    Clock::time_point start = Clock::now();
+    for (size_t n = 0; n < inputs.size(); n += 5)
+    {
+      const Array *in = &inputs[n];
+      if (scalar_filter)
+      {
+        for (int i = 0; i < 6; i++)
+          sum(i) += C3Trajectory::c3filter(in[0](i), in[1](i), in[2](i), in[3](i), in[4](i), 0, vmin(i), vmax(i),
+                                           amin(i), amax(i), umax(i));
+      }
+      else
+      {
+        sum += C3Trajectory::c3filter_vectorized(in[0], in[1], in[2], in[3], in[4], zero, vmin, vmax, amin, amax, umax);
+      }
+    }
+    best = std::min(best, elapsed(start));
+    volatile double sink = sum.sum();
+    (void)sink;
+  }
+
+  std::printf("filter %-10s %8.1f ns per 6 axes\n", scalar_filter ? "scalar" : "vectorized",
+              1e9 * best / (inputs.size() / 5));
+}
+
+static void benchmark_rollout(const C3Scenario &scenario, bool exact, double dt)
+{
+  C3Trajectory start(scenario.start, c3_scenario_limits());
+  C3Rollout rollout(dt, exact, 10000);
+  double best = 1e9;
+  bool arrived = false;
+  for (int r = 0; r < 5; r++)
+  {
+    Clock::time_point t = Clock::now();
+    arrived = rollout.run(start, scenario.waypoint, 0.01, 0.01, 0.1, 2 * scenario.duration);
+    best = std::min(best, elapsed(t));
+  }
+
+  std::printf("  rollout %-5s %8.2f ms to arrive in %.2f s%s\n", exact ? "exact" : "fixed", 1e3 * best,
+              rollout.time_to_arrival(), arrived ? "" : " (did not arrive)");
+}
+
+int main()
+{
+  benchmark_filter(false);
+  benchmark_filter(true);
+  for (const C3Scenario &scenario : c3_scenarios())
+  {
+    std::printf("%s\n", scenario.name.c_str());
+    benchmark_update(scenario, false, false, 1e-4);
+    benchmark_update(scenario, false, true, 1e-4);
+    benchmark_update(scenario, true, false, 0.002);
+    benchmark_update(scenario, true, true, 0.002);
+    benchmark_rollout(scenario, false, 1e-4);
+    benchmark_rollout(scenario, true, 0.002);
+  }
+  return 0;
+}
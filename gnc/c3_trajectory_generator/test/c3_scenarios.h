@@ -0,0 +1,62 @@
+#ifndef C3TRAJECTORY_TEST_C3_SCENARIOS_H
+#define C3TRAJECTORY_TEST_C3_SCENARIOS_H
+
+#include <string>
+#include <vector>
+
+#include "C3Trajectory.h"
+
+namespace subjugator
+{
+// Representative moves shared by the golden regression test and the benchmark
+struct C3Scenario
+{
+  std::string name;
+  C3Trajectory::Point start;
+  C3Trajectory::Waypoint waypoint;
+  // Long enough to arrive and settle
+  double duration;
+};
+
+// Same limits as the sub's launch file
+inline C3Trajectory::Limits c3_scenario_limits()
+{
+  C3Trajectory::Limits limits;
+  limits.vmin_b << -0.7, -0.35, -0.5, -0.75, -0.5, -300;
+  limits.vmax_b << 0.7, 0.35, 0.5, 0.75, 0.5, 300;
+  limits.amin_b << -0.35, -0.15, -0.25, -1.5, -0.2, -300;
+  limits.amax_b << 0.35, 0.15, 0.25, 1.5, 0.2, 300;
+  limits.arevoffset_b << 0.0, 0, 0;
+  limits.umax_b << 1, 1, 1, 1, 1, 10;
+  return limits;
+}
+
+inline C3Scenario c3_scenario(const std::string &name, const Vector6d &start, const Vector6d &goal, double speed,
+                              bool coordinate_unaligned, double duration)
+{
+  C3Scenario scenario;
+  scenario.name = name;
+  scenario.start = C3Trajectory::Point(start, Vector6d::Zero());
+  scenario.waypoint = C3Trajectory::Waypoint(C3Trajectory::Point(goal, Vector6d::Zero()), speed, coordinate_unaligned,
+                                             false);
+  scenario.duration = duration;
+  return scenario;
+}
+
+inline std::vector<C3Scenario> c3_scenarios()
+{
+  std::vector<C3Scenario> scenarios;
+  // Turn in place across the +-pi wrap
+  scenarios.push_back(c3_scenario("pure_yaw", (Vector6d() << 0, 0, -1, 0, 0, 2.5).finished(),
+                                  (Vector6d() << 0, 0, -1, 0, 0, -2.5).finished(), 0, true, 4));
+  scenarios.push_back(c3_scenario("long_diagonal", (Vector6d() << 0, 0, -1, 0, 0, 0.3).finished(),
+                                  (Vector6d() << 20, -12, -4, 0, 0, 0.3).finished(), 0, true, 56));
+  scenarios.push_back(c3_scenario("speed_limited", (Vector6d() << 0, 0, -1, 0, 0, 0).finished(),
+                                  (Vector6d() << 5, 3, -2, 0, 0, 1).finished(), 0.2, true, 30));
+  scenarios.push_back(c3_scenario("uncoordinated", (Vector6d() << 1, 2, -1, 0, 0, -0.5).finished(),
+                                  (Vector6d() << 7, -2, -3, 0, 0, 1.2).finished(), 0, false, 25));
+  return scenarios;
+}
+};
+
+#endif
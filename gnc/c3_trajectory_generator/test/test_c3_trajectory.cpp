@@ -0,0 +1,366 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <limits>
+#include <random>
+#include <sstream>
+
+#include "c3_scenarios.h"
+
+using namespace subjugator;
+
+// Golden trajectories live in test/golden/<scenario>_<mode>.csv, one row per sample: t, q, qdot, qdotdot.
+// After an intentional change to the trajectory, regenerate them with
+//   C3_GOLDEN_REGENERATE=1 rosrun c3_trajectory_generator c3_trajectory_generator_test
+// and commit the new files together with the change.
+static const double SAMPLE_PERIOD = 0.25;
+
+typedef std::vector<std::vector<double> > Samples;
+
+static Samples sample_scenario(const C3Scenario &scenario, bool exact, double dt)
+{
+  C3Trajectory trajectory(scenario.start, c3_scenario_limits());
+  Samples samples;
+  int steps_per_sample = std::round(SAMPLE_PERIOD / dt);
+  int steps = std::round(scenario.duration / dt);
+  for (int i = 0; i <= steps; i++)
+  {
+    if (i % steps_per_sample == 0)
+    {
+      C3Trajectory::PointWithAcceleration p = trajectory.getCurrentPoint();
+      std::vector<double> row(1, i * dt);
+      row.insert(row.end(), p.q.data(), p.q.data() + 6);
+      row.insert(row.end(), p.qdot.data(), p.qdot.data() + 6);
+      row.insert(row.end(), p.qdotdot.data(), p.qdotdot.data() + 6);
+      samples.push_back(row);
+    }
+    if (exact)
+      trajectory.update_exact(dt, scenario.waypoint, i * dt);
+    else
+      trajectory.update(dt, scenario.waypoint, i * dt);
+  }
+  return samples;
+}
+
+static std::string golden_path(const C3Scenario &scenario, const std::string &mode)
+{
+  return std::string(C3_GOLDEN_DIR) + "/" + scenario.name + "_" + mode + ".csv";
+}
+
+static void write_golden(const std::string &path, const Samples &samples)
+{
+  std::ofstream out(path.c_str());
+  out << "# t, q[6], qdot[6], qdotdot[6]\n";
+  out.precision(12);
+  for (const std::vector<double> &row : samples)
+  {
+    for (size_t i = 0; i < row.size(); i++)
+      out << (i ? "," : "") << row[i];
+    out << "\n";
+  }
+}
+
+static bool read_golden(const std::string &path, Samples &samples)
+{
+  std::ifstream in(path.c_str());
+  if (!in)
+    return false;
+  std::string line;
+  while (std::getline(in, line))
+  {
+    if (line.empty() || line[0] == '#')
+      continue;
+    std::vector<double> row;
+    std::stringstream ss(line);
+    std::string field;
+    while (std::getline(ss, field, ','))
+      row.push_back(std::atof(field.c_str()));
+    samples.push_back(row);
+  }
+  return true;
+}
+
+static void check_golden(const std::string &mode, bool exact, double dt)
+{
+  C3Trajectory::Limits limits = c3_scenario_limits();
+  for (const C3Scenario &scenario : c3_scenarios())
+  {
+    SCOPED_TRACE(scenario.name + " " + mode);
+    Samples actual = sample_scenario(scenario, exact, dt);
+    std::string path = golden_path(scenario, mode);
+    if (std::getenv("C3_GOLDEN_REGENERATE"))
+    {
+      write_golden(path, actual);
+      continue;
+    }
+
+    Samples expected;
+    ASSERT_TRUE(read_golden(path, expected)) << "missing " << path;
+    ASSERT_EQ(expected.size(), actual.size());
+    for (size_t k = 0; k < expected.size(); k++)
+    {
+      ASSERT_EQ(19u, expected[k].size());
+      for (int i = 0; i < 6; i++)
+      {
+        double dq = expected[k][1 + i] - actual[k][1 + i];
+        if (i >= 3)
+          dq = std::remainder(dq, 2 * M_PI);
+        EXPECT_NEAR(0, dq, 1e-6) << "q[" << i << "] at t = " << expected[k][0];
+        EXPECT_NEAR(expected[k][7 + i], actual[k][7 + i], 1e-5) << "qdot[" << i << "] at t = " << expected[k][0];
+        // At rest the jerk chatters between +-umax on every axis, so rounding-level changes can shift the body
+        // frame acceleration by a few umax * dt steps, rotated into the fixed frame
+        EXPECT_NEAR(expected[k][13 + i], actual[k][13 + i], 8 * limits.umax_b(i) * dt)
+            << "qdotdot[" << i << "] at t = " << expected[k][0];
+      }
+    }
+  }
+}
+
+TEST(C3TrajectoryTest, matchesGoldenFixed)
+{
+  check_golden("fixed", false, 1e-4);
+}
+
+TEST(C3TrajectoryTest, matchesGoldenExact)
+{
+  check_golden("exact", true, 0.002);
+}
+
+TEST(C3TrajectoryTest, vectorizedFilterMatchesScalar)
+{
+  for (const C3Scenario &scenario : c3_scenarios())
+  {
+    SCOPED_TRACE(scenario.name);
+    C3Trajectory vectorized(scenario.start, c3_scenario_limits());
+    C3Trajectory scalar(scenario.start, c3_scenario_limits());
+    scalar.use_scalar_filter = true;
+    for (double t = 0; t < scenario.duration; t += 0.002)
+    {
+      vectorized.update_exact(0.002, scenario.waypoint, t);
+      scalar.update_exact(0.002, scenario.waypoint, t);
+    }
+    EXPECT_TRUE(vectorized.getCurrentPoint().is_approximately(scalar.getCurrentPoint(), 1e-6, 1e-6));
+  }
+}
+
+// The kernels compute S with x * x * x where c3filter has pow(x, 3), so S may differ by a few rounding errors of the
+// largest term summed into it. The jerk is -umax, 0 or umax either way, and only differs for a lane whose S is that
+// close to a switching surface: nudging the scalar path's e (which S is linear in) by the same amount must reproduce it.
+static const double FILTER_ULP_BOUND = 8;
+
+// Largest magnitude of the terms of S, with umax == 1 and rdotdot == 0
+static double filter_term_scale(double e, double edot, double edotdot, double edotdotmin, double edotdotmax)
+{
+  double k = edotdot * edotdot + 2 * std::abs(edot);
+  double a = std::min(std::abs(edotdotmin), std::abs(edotdotmax));
+  return std::max({ std::abs(e), std::max(std::abs(edotdotmin), std::abs(edotdotmax)) * k / 4, k * k / (8 * a),
+                    std::abs(edotdot) * (3 * std::abs(edot) + edotdot * edotdot) / 3, std::sqrt(2 * k * k * k) / 4 });
+}
+
+// The position error at which c3filter's jerk changes, by bisection, or 0 if it is the same across [-4, 4]
+static double switching_error(double qdot, double qdotdot, double r, double rdot, double vmin, double vmax,
+                              double amin, double amax)
+{
+  auto u = [&](double e) { return C3Trajectory::c3filter(r + e, qdot, qdotdot, r, rdot, 0, vmin, vmax, amin, amax, 1); };
+  double low = -4, high = 4;
+  if (u(low) == u(high))
+    return 0;
+  while (high - low > 4 * std::numeric_limits<double>::epsilon())
+  {
+    double middle = (low + high) / 2;
+    (u(middle) == u(low) ? low : high) = middle;
+  }
+  return low;
+}
+
+TEST(C3TrajectoryTest, vectorizedFilterMatchesScalarPerCall)
+{
+  typedef C3Trajectory::Array Array;
+  C3Trajectory::Limits limits = c3_scenario_limits();
+  Array vmin = limits.vmin_b.array(), vmax = limits.vmax_b.array();
+  Array amin = limits.amin_b.array(), amax = limits.amax_b.array();
+  Array umax = Array::Ones();
+
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> distribution(-2, 2);
+  int differing = 0;
+  const int calls = 100000;
+  for (int n = 0; n < calls; n++)
+  {
+    Array q, qdot, qdotdot, r, rdot;
+    for (int i = 0; i < 6; i++)
+    {
+      q(i) = distribution(rng);
+      qdot(i) = distribution(rng);
+      qdotdot(i) = distribution(rng);
+      r(i) = distribution(rng);
+      rdot(i) = distribution(rng) / 4;
+      // Every other call, move q onto the surface where the scalar path's jerk flips sign, if there is one
+      if (n % 2 == 0)
+        q(i) = r(i) + switching_error(qdot(i), qdotdot(i), r(i), rdot(i), vmin(i), vmax(i), amin(i), amax(i));
+    }
+    Array u = C3Trajectory::c3filter_vectorized(q, qdot, qdotdot, r, rdot, Array::Zero(), vmin, vmax, amin, amax, umax);
+    for (int i = 0; i < 6; i++)
+    {
+      double expected = C3Trajectory::c3filter(q(i), qdot(i), qdotdot(i), r(i), rdot(i), 0, vmin(i), vmax(i),
+                                               amin(i), amax(i), umax(i));
+      if (u(i) == expected)
+        continue;
+      differing++;
+      double eps = FILTER_ULP_BOUND * std::numeric_limits<double>::epsilon() *
+                   filter_term_scale(q(i) - r(i), qdot(i) - rdot(i), qdotdot(i), amin(i), amax(i));
+      bool near_surface = false;
+      for (double nudge : { -eps, eps })
+        near_surface |= C3Trajectory::c3filter(q(i) + nudge, qdot(i), qdotdot(i), r(i), rdot(i), 0, vmin(i), vmax(i),
+                                               amin(i), amax(i), umax(i)) == u(i);
+      EXPECT_TRUE(near_surface) << "axis " << i << " call " << n << ": " << u(i) << " vs " << expected;
+    }
+  }
+  // Half the lanes sit on a surface, and nearly all of those still agree
+  EXPECT_LT(differing, calls / 10);
+}
+
+TEST(C3TrajectoryTest, shouldBlendWaitsForRotation)
+{
+  // A waypoint that only turns is at the sub's position, but isn't reached until the turn is done
+  C3Scenario scenario = c3_scenarios()[0];
+  C3Trajectory trajectory(scenario.start, c3_scenario_limits());
+  EXPECT_FALSE(trajectory.should_blend(scenario.waypoint, 0.5, 0.1));
+  EXPECT_TRUE(trajectory.should_blend(C3Trajectory::Waypoint(scenario.start), 0.5, 0.1));
+}
+
+TEST(C3TrajectoryTest, shouldBlendOnlyCountsBrakingTowardsWaypoint)
+{
+  C3Trajectory::Limits limits = c3_scenario_limits();
+  // Moving at full speed along x, which takes 0.7^2 / (2 * 0.35) = 0.7 m to stop
+  C3Trajectory::Point start(Vector6d::Zero(), (Vector6d() << 0.7, 0, 0, 0, 0, 0).finished());
+  C3Trajectory trajectory(start, limits);
+  C3Trajectory::Waypoint ahead(C3Trajectory::Point((Vector6d() << 0.6, 0, 0, 0, 0, 0).finished(), Vector6d::Zero()));
+  C3Trajectory::Waypoint beside(C3Trajectory::Point((Vector6d() << 0, 0.6, 0, 0, 0, 0).finished(), Vector6d::Zero()));
+  C3Trajectory::Waypoint behind(C3Trajectory::Point((Vector6d() << -0.6, 0, 0, 0, 0, 0).finished(), Vector6d::Zero()));
+  EXPECT_TRUE(trajectory.should_blend(ahead, 0.1, 0.1));
+  EXPECT_FALSE(trajectory.should_blend(beside, 0.1, 0.1));
+  EXPECT_FALSE(trajectory.should_blend(behind, 0.1, 0.1));
+}
+
+// The float instantiation, for bulk rollouts, follows the double one to well within a tolerance a goal would use
+TEST(C3TrajectoryTest, floatFollowsDouble)
+{
+  C3Trajectory::Limits limits = c3_scenario_limits();
+  C3Trajectoryf::Limits limitsf;
+  limitsf.vmin_b = limits.vmin_b.cast<float>();
+  limitsf.vmax_b = limits.vmax_b.cast<float>();
+  limitsf.amin_b = limits.amin_b.cast<float>();
+  limitsf.amax_b = limits.amax_b.cast<float>();
+  limitsf.arevoffset_b = limits.arevoffset_b.cast<float>();
+  limitsf.umax_b = limits.umax_b.cast<float>();
+
+  for (const C3Scenario &scenario : c3_scenarios())
+  {
+    SCOPED_TRACE(scenario.name);
+    C3Trajectory trajectory(scenario.start, limits);
+    C3Trajectoryf trajectoryf(C3Trajectoryf::Point(scenario.start.q.cast<float>(), scenario.start.qdot.cast<float>()),
+                              limitsf);
+    C3Trajectoryf::Waypoint waypointf(
+        C3Trajectoryf::Point(scenario.waypoint.r.q.cast<float>(), scenario.waypoint.r.qdot.cast<float>()),
+        scenario.waypoint.speed, scenario.waypoint.coordinate_unaligned, scenario.waypoint.do_waypoint_validation);
+    for (int i = 0; i * 0.002 < scenario.duration; i++)
+    {
+      trajectory.update_exact(0.002, scenario.waypoint, i * 0.002);
+      trajectoryf.update_exact(0.002f, waypointf, i * 0.002f);
+    }
+    C3Trajectoryf::PointWithAcceleration pf = trajectoryf.getCurrentPoint();
+    C3Trajectory::Point p(pf.q.cast<double>(), pf.qdot.cast<double>());
+    EXPECT_TRUE(p.is_approximately(trajectory.getCurrentPoint(), 1e-3, 1e-3));
+  }
+}
+
+// In the plane (no z, roll or pitch motion) the 3-DOF surface instantiation is the 6-DOF one restricted to x, y, yaw
+TEST(C3TrajectoryTest, surfaceMatchesPlanarMotion)
+{
+  C3Trajectory::Limits limits = c3_scenario_limits();
+  SurfaceC3Trajectory::Limits surface_limits;
+  const int axes[] = { 0, 1, 5 };
+  for (int i = 0; i < 3; i++)
+  {
+    surface_limits.vmin_b(i) = limits.vmin_b(axes[i]);
+    surface_limits.vmax_b(i) = limits.vmax_b(axes[i]);
+    surface_limits.amin_b(i) = limits.amin_b(axes[i]);
+    surface_limits.amax_b(i) = limits.amax_b(axes[i]);
+    surface_limits.umax_b(i) = limits.umax_b(axes[i]);
+  }
+  surface_limits.arevoffset_b = limits.arevoffset_b.head<2>();
+
+  for (C3Scenario scenario : c3_scenarios())
+  {
+    SCOPED_TRACE(scenario.name);
+    scenario.waypoint.r.q(2) = scenario.start.q(2);
+    Eigen::Vector3d start, goal;
+    for (int i = 0; i < 3; i++)
+    {
+      start(i) = scenario.start.q(axes[i]);
+      goal(i) = scenario.waypoint.r.q(axes[i]);
+    }
+    C3Trajectory trajectory(scenario.start, limits);
+    SurfaceC3Trajectory surface(SurfaceC3Trajectory::Point(start, Eigen::Vector3d::Zero()), surface_limits);
+    SurfaceC3Trajectory::Waypoint waypoint(SurfaceC3Trajectory::Point(goal, Eigen::Vector3d::Zero()),
+                                           scenario.waypoint.speed, scenario.waypoint.coordinate_unaligned, false);
+    for (int i = 0; i * 0.002 < scenario.duration; i++)
+    {
+      trajectory.update_exact(0.002, scenario.waypoint, i * 0.002);
+      surface.update_exact(0.002, waypoint, i * 0.002);
+      if (i % 100 == 0)
+      {
+        C3Trajectory::PointWithAcceleration p = trajectory.getCurrentPoint();
+        SurfaceC3Trajectory::PointWithAcceleration s = surface.getCurrentPoint();
+        for (int j = 0; j < 3; j++)
+        {
+          ASSERT_NEAR(p.q(axes[j]), s.q(j), 1e-9) << "axis " << axes[j] << " at step " << i;
+          ASSERT_NEAR(p.qdot(axes[j]), s.qdot(j), 1e-9) << "axis " << axes[j] << " at step " << i;
+        }
+      }
+    }
+  }
+}
+
+// Roll, pitch and yaw are applied about x, then y, then z. R(0, 2) once had cphi * cphi * stheta in place of
+// cpsi * cphi * stheta, which none of the scenarios catch because they never roll or pitch.
+TEST(C3TrajectoryTest, rotationMatchesEulerAngles)
+{
+  typedef C3Frame<double, 6> Frame;
+  std::mt19937 rng(1);
+  std::uniform_real_distribution<double> angle(-M_PI, M_PI);
+  for (int n = 0; n < 100; n++)
+  {
+    Vector6d q;
+    q << 0, 0, 0, angle(rng), angle(rng) / 2, angle(rng);
+    Eigen::Matrix3d expected = (Eigen::AngleAxisd(q(5), Eigen::Vector3d::UnitZ()) *
+                                Eigen::AngleAxisd(q(4), Eigen::Vector3d::UnitY()) *
+                                Eigen::AngleAxisd(q(3), Eigen::Vector3d::UnitX()))
+                                   .toRotationMatrix();
+    EXPECT_TRUE(Frame::rotation(q).isApprox(expected, 1e-12)) << "rpy " << q.tail<3>().transpose();
+  }
+}
+
+// R(0, 2) on its own, at an attitude where cphi * cphi * stheta and cpsi * cphi * stheta differ by far more than the
+// tolerance, so the entry can't drift back unnoticed
+TEST(C3TrajectoryTest, rotationEntryZeroTwo)
+{
+  typedef C3Frame<double, 6> Frame;
+  const double phi = 0.4, theta = 0.3, psi = 1.2;
+  Vector6d q;
+  q << 0, 0, 0, phi, theta, psi;
+  const double expected = std::sin(psi) * std::sin(phi) + std::cos(psi) * std::cos(phi) * std::sin(theta);
+  const double old = std::sin(psi) * std::sin(phi) + std::cos(phi) * std::cos(phi) * std::sin(theta);
+  ASSERT_GT(std::abs(expected - old), 0.1);
+  EXPECT_NEAR(expected, Frame::rotation(q)(0, 2), 1e-12);
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,122 @@
+#pragma once
+#include <opencv2/core/core.hpp>
+
+#include <cmath>
+#include <cstdlib>
+#include <utility>
+#include <vector>
+
+#include <LogOdds.hpp>
+#include <TiledOgrid.hpp>
+
+// Bresenham: walks from start to end one cell at a time, moving along the major axis every step and along the minor
+// axis whenever the error term overflows
+class LineWalk
+{
+public:
+  LineWalk(cv::Point start, cv::Point end)
+    : x(start.x)
+    , y(start.y)
+    , sx(end.x >= start.x ? 1 : -1)
+    , sy(end.y >= start.y ? 1 : -1)
+    , x_major_(std::abs(end.x - start.x) >= std::abs(end.y - start.y))
+    , major_(x_major_ ? std::abs(end.x - start.x) : std::abs(end.y - start.y))
+    , minor_(x_major_ ? std::abs(end.y - start.y) : std::abs(end.x - start.x))
+    , error_(2 * minor_ - major_)
+  {
+  }
+
+  int x, y;
+  const int sx, sy;
+
+  // Steps from start to end
+  int length() const
+  {
+    return major_;
+  }
+
+  // Usage: Move to the next cell, calling move_x() and/or move_y() after x or y changed
+  template <typename X, typename Y>
+  void step(X move_x, Y move_y)
+  {
+    x_major_ ? (x += sx, move_x()) : (y += sy, move_y());
+    if (error_ > 0)
+    {
+      x_major_ ? (y += sy, move_y()) : (x += sx, move_x());
+      error_ -= 2 * major_;
+    }
+    error_ += 2 * minor_;
+  }
+
+  void step()
+  {
+    step([] {}, [] {});
+  }
+
+private:
+  const bool x_major_;
+  const int major_, minor_;
+  int error_;
+};
+
+// Casts the beams of a sonar ping across a CV_16S log-odds ogrid (see LogOdds.hpp), dense or tiled. Each beam is walked
+// cell by cell with an integer DDA, once: cells in front of the first confident hit are degraded towards free, cells
+// from hit_buffer cells past it to the end of the beam are reset to unknown, and beams without a confident hit are
+// left alone.
+class BeamRaycaster
+{
+public:
+  BeamRaycaster();
+
+  // A cell above certainty stops the beam
+  int16_t certainty;
+  // Only cells in front of the hit below uncertainty are degraded, by degrade
+  int16_t uncertainty;
+  int degrade;
+  // How many cells past the hit are left alone, to cover the object's depth
+  int hit_buffer;
+
+  // Usage: Cast one beam from start to end, in ogrid cells. start must be in the ogrid, the beam stops where it leaves
+  // it. Grows dirty to cover the cells that were changed and returns whether the beam hit something.
+  // For a ring buffered ogrid (see RollingWindow.hpp) the cells are window cells and offset the window's offset.
+  bool cast(cv::Mat &ogrid, cv::Point start, cv::Point end, cv::Rect &dirty, cv::Point offset = cv::Point());
+  // Only writes the cells it changes, so tiles stay uniform where the beam had no effect
+  bool cast(TiledOgrid &ogrid, cv::Point start, cv::Point end, cv::Rect &dirty);
+
+  // Usage: Cast beams from start every angle_step from first_angle to last_angle (radians, in the ogrid's frame,
+  // either order), each length cells long. Returns a rectangle covering every cell that was changed.
+  cv::Rect cast_fan(cv::Mat &ogrid, cv::Point2d start, double first_angle, double last_angle, double angle_step,
+                    double length, cv::Point offset = cv::Point())
+  {
+    return fan(start, first_angle, last_angle, angle_step, length,
+               [&](cv::Point from, cv::Point to, cv::Rect &dirty) { cast(ogrid, from, to, dirty, offset); });
+  }
+  cv::Rect cast_fan(TiledOgrid &ogrid, cv::Point2d start, double first_angle, double last_angle, double angle_step,
+                    double length)
+  {
+    return fan(start, first_angle, last_angle, angle_step, length,
+               [&](cv::Point from, cv::Point to, cv::Rect &dirty) { cast(ogrid, from, to, dirty); });
+  }
+
+private:
+  // Cells in front of the hit on the current beam
+  std::vector<int16_t *> front_;
+  // Cells in front of the hit on the current beam of a tiled ogrid, and what they become
+  std::vector<std::pair<cv::Point, int16_t>> front_cells_;
+
+  template <typename F>
+  static cv::Rect fan(cv::Point2d start, double first_angle, double last_angle, double angle_step, double length,
+                      F cast_beam)
+  {
+    cv::Rect dirty;
+    cv::Point start_cell(std::floor(start.x), std::floor(start.y));
+    int beams = std::max(1, int(std::ceil(std::abs(last_angle - first_angle) / angle_step)));
+    for (int k = 0; k <= beams; ++k)
+    {
+      double angle = first_angle + (last_angle - first_angle) * k / beams;
+      cv::Point end(std::floor(start.x + std::cos(angle) * length), std::floor(start.y + std::sin(angle) * length));
+      cast_beam(start_cell, end, dirty);
+    }
+    return dirty;
+  }
+};
@@ -26,19 +26,29 @@
 #include <visualization_msgs/Marker.h>
 #include <visualization_msgs/MarkerArray.h>
 
+#include <BeamRaycaster.hpp>
+#include <LogOdds.hpp>
 #include <waypoint_validity.hpp>  // C3
 
 class Classification
 {
   ros::NodeHandle *nh_;
 
-  // Usage: Given starting point, and an angle, find the first occupied point in that direction.
-  cv::Point2d get_first_hit(cv::Mat &mat_ogrid, cv::Point2d start, float theta, int max_dis);
-
   float certainty_as_hit_;
   int hit_buffer_;
   float uncertainty_as_hit_;
   float not_hit_degrade_;
+  BeamRaycaster raycaster_;
+
+  // Where a ping's beams start and end, in ogrid cells and radians
+  struct Sector
+  {
+    cv::Point2d start;
+    double first_angle, last_angle, length;
+  };
+  // Usage: Refresh raycaster_'s parameters and find the sector to cast, false if the ping has none
+  bool sector(cv::Size size, float resolution, const tf::StampedTransform &transform, const cv::Point &mat_origin,
+              float min_bearing, float max_bearing, float max_range, Sector &s);
 
 public:
   Classification(ros::NodeHandle *nh);
@@ -49,11 +59,18 @@ public:
   // Usage: obtain a clustering from pointcloud
   std::vector<pcl::PointIndices> clustering(pcl::PointCloud<pcl::PointXYZI>::ConstPtr pointCloud);
 
-  /* Usage: Find all the first occupied points in an expanding circle, then color the ogrid
-     param mat_ogrid: what ogrid will be used for processing and drawn on
+  /* Usage: Find the first occupied points along the beams of a sonar ping, then color the ogrid
+     param mat_ogrid: what ogrid will be used for processing and drawn on, CV_16S log-odds (see LogOdds.hpp), or a
+                     TiledOgrid of them
      param resolution: used to convert meters to pixels
-     param transform: get subs pose
+     param transform: get sonar pose
      param mat_origin: where the center of the ogrid is in resepct to map frame
+     param min_bearing, max_bearing, max_range: the sector the ping covered, in the sonar frame
+     param storage_offset: the RollingWindow offset, if mat_ogrid is ring buffered
+     returns: a rectangle covering every cell that was changed
   */
-  void zonify(cv::Mat &mat_ogrid, float resolution, const tf::StampedTransform &transform, cv::Point &mat_origin);
+  cv::Rect zonify(cv::Mat &mat_ogrid, float resolution, const tf::StampedTransform &transform, cv::Point &mat_origin,
+                  float min_bearing, float max_bearing, float max_range, cv::Point storage_offset = cv::Point());
+  cv::Rect zonify(TiledOgrid &ogrid, float resolution, const tf::StampedTransform &transform, cv::Point &mat_origin,
+                  float min_bearing, float max_bearing, float max_range);
 };
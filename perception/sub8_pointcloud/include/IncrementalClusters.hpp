@@ -0,0 +1,97 @@
+#pragma once
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cstdint>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+// Euclidean clusters (points chained together by gaps of at most tolerance) kept up to date as points come and go,
+// instead of being extracted from the whole cloud every time they are asked for.
+//
+// Points are hashed into cells tolerance wide, so a point's neighbors are all in the 27 cells around it, and clusters
+// are a union-find over the points. A new point is joined with the neighbors it finds, merging their clusters. Removing
+// a point may split its cluster, which union-find can't undo, so the cluster is only marked and is split again from its
+// remaining points the next time the clusters are asked for. Adding a point costs its neighbors, and asking costs the
+// clusters plus the points of those that lost some.
+class IncrementalClusters
+{
+public:
+  struct Cluster
+  {
+    pcl::PointXYZ centroid;
+    // Bounding box of the points
+    pcl::PointXYZ min, max;
+    std::vector<pcl::PointXYZI> points;
+  };
+
+  explicit IncrementalClusters(float tolerance = 1);
+
+  float tolerance() const
+  {
+    return tolerance_;
+  }
+
+  // Usage: Add point id, or move it if it is already there. Moving costs about as much as adding, and the cluster's
+  // box is only shrunk back to a point that moved inwards when it is next split.
+  void update(uint64_t id, const pcl::PointXYZI &point);
+
+  void remove(uint64_t id);
+
+  void clear();
+
+  size_t size() const
+  {
+    return index_.size();
+  }
+
+  // Usage: The clusters with between min_size and max_size points, splitting those that lost points first
+  void clusters(size_t min_size, size_t max_size, std::vector<Cluster> &out);
+
+private:
+  struct Node
+  {
+    pcl::PointXYZI point;
+    uint64_t cell;
+    // Union-find parent, and the next node of the cluster in a circular list
+    uint32_t parent, next;
+    bool alive;
+  };
+  // Kept for roots only
+  struct Aggregate
+  {
+    size_t size;
+    double x, y, z;
+    pcl::PointXYZ min, max;
+    // Points were removed, so it may have to be split
+    bool dirty;
+  };
+
+  float tolerance_;
+  std::vector<Node> nodes_;
+  std::vector<Aggregate> aggregates_;
+  std::vector<uint32_t> free_;
+  // Point id to node
+  std::unordered_map<uint64_t, uint32_t> index_;
+  // Cell to the live nodes in it
+  std::unordered_map<uint64_t, std::vector<uint32_t>> cells_;
+  std::unordered_set<uint32_t> roots_;
+  // Roots that were marked dirty, some of which may since have been merged
+  std::vector<uint32_t> dirty_;
+  // Scratch space for split
+  std::vector<uint32_t> members_;
+
+  uint64_t cell(const pcl::PointXYZI &point) const;
+  uint32_t find(uint32_t n);
+  void unite(uint32_t a, uint32_t b);
+  // Unite n with every live node within tolerance of it. With old, where n was before, whether it moved out of
+  // tolerance of any of them.
+  bool link(uint32_t n, const pcl::PointXYZI *old = nullptr);
+  void mark_dirty(uint32_t root);
+  // Make n a cluster of its own
+  void reset(uint32_t n);
+  void remove_from_cell(uint32_t n);
+  // Rebuild the clusters of root's live points and free its dead ones
+  void split(uint32_t root);
+};
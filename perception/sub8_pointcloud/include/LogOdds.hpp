@@ -0,0 +1,29 @@
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+// Occupancy stored as fixed point log-odds, log(p / (1 - p)) * LOG_ODDS_ONE, in int16_t (CV_16S) cells.
+// 0 is unknown (p = 0.5), and evidence for and against a cell adds up instead of saturating at p = 1.
+const int LOG_ODDS_ONE = 1024;
+// Cells are clamped to p = 0.03 and p = 0.97, so they can be unlearned as quickly as they were learned
+const int16_t LOG_ODDS_MIN = -3559;
+const int16_t LOG_ODDS_MAX = 3559;
+
+inline int16_t log_odds_from_probability(double p)
+{
+  p = std::min(std::max(p, 1e-6), 1 - 1e-6);
+  double l = std::round(std::log(p / (1 - p)) * LOG_ODDS_ONE);
+  return std::min<double>(std::max<double>(l, LOG_ODDS_MIN), LOG_ODDS_MAX);
+}
+
+inline double probability_from_log_odds(int16_t l)
+{
+  return 1 / (1 + std::exp(-double(l) / LOG_ODDS_ONE));
+}
+
+// Add delta to a cell, keeping it within [LOG_ODDS_MIN, LOG_ODDS_MAX]
+inline int16_t log_odds_add(int16_t l, int delta)
+{
+  return std::min<int>(std::max<int>(l + delta, LOG_ODDS_MIN), LOG_ODDS_MAX);
+}
@@ -1,7 +1,11 @@
 #pragma once
 #include <geometry_msgs/Point.h>
 #include <mil_blueview_driver/BlueViewPing.h>
+#include <map_msgs/OccupancyGridUpdate.h>
 #include <nav_msgs/OccupancyGrid.h>
+#include <nodelet/nodelet.h>
+#include <pluginlib/class_list_macros.h>
+#include <ros/callback_queue.h>
 #include <ros/ros.h>
 
 #include <tf/transform_listener.h>
@@ -22,13 +26,24 @@
 #include <visualization_msgs/Marker.h>
 #include <visualization_msgs/MarkerArray.h>
 
-#include <boost/circular_buffer.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/mutex.hpp>
 
 #include <sub8_msgs/Bounds.h>
 
+#include <VoxelMap.h>
+#include <c3_trajectory_generator/OccupiedVoxels.h>
+#include <c3_trajectory_generator/OgridUpdate.h>
 #include <waypoint_validity.hpp>
 
 #include <Classification.hpp>
+#include <IncrementalClusters.hpp>
+#include <ObjectTracker.hpp>
+#include <LogOdds.hpp>
+#include <PingConverter.hpp>
+#include <PointStore.hpp>
+#include <RollingWindow.hpp>
+#include <TiledOgrid.hpp>
 
 #include <mil_msgs/ObjectDBQuery.h>
 #include <mil_msgs/PerceptionObject.h>
@@ -40,7 +55,7 @@
 extern struct ogrid_param
 {
   bool ogrid;
-  // Statistical Outlier Removal
+  // Statistical Outlier Removal, of point_cloud/filtered in debug
   float statistical_mean_k;
   float statistical_stddev_mul_thresh;
   // Euclidian Clustering
@@ -59,7 +74,9 @@ class OGridGen
 
 {
 public:
-  OGridGen();
+  // nh is the node's private node handle
+  OGridGen(const ros::NodeHandle &nh);
+  ~OGridGen();
   void publish_big_pointcloud(const ros::TimerEvent &);
 
   void callback(const mil_blueview_driver::BlueViewPingPtr &ping_msg);
@@ -71,19 +88,40 @@ public:
 
   bool get_objects_callback(mil_msgs::ObjectDBQuery::Request &req, mil_msgs::ObjectDBQuery::Response &res);
 
-  // Publish mat_ogrid
+  // Publish mat_ogrid, in full every keyframe_period_ and otherwise only its dirty_ cells
   void publish_ogrid();
+  // Publish the dirty_ cells of mat_ogrid as an OgridUpdate of the last full ogrid, and as an OccupancyGridUpdate for
+  // rviz when it is subscribed
+  void publish_ogrid_update(const ros::Time &stamp);
+  // Publish the voxels of voxels_ with at least voxel_min_hits_ hits
+  void publish_voxels();
   // Project point_cloud and make a persistant ogrid
   void process_persistant_ogrid(pcl::PointCloud<pcl::PointXYZI>::Ptr point_cloud_plane);
-  // Convert persistant ogrid to a mat_ogrid
-  void populate_mat_ogrid();
-
-  mil_msgs::PerceptionObjectArray cluster(pcl::PointCloud<pcl::PointXYZI>::Ptr pc);
+  // Raycast the ping's sector, then convert the dirty_ part of persistant ogrid to a mat_ogrid
+  void populate_mat_ogrid(float min_bearing, float max_bearing, float max_range);
+  // Rethreshold and republish the whole ogrid next ping
+  void mark_all_dirty();
+  // Move the ogrid's center to origin (whole meters in the map frame), keeping what is still inside it
+  void scroll_to(const cv::Point &origin);
+  // Remove the voxels points_ dropped from clusters_
+  void forget_removed_points();
+
+  // Match clusters to tracker_'s objects, or if the clusters haven't changed only expire the objects. Publish the
+  // objects and keep them in objects_ when they changed, republish objects_ otherwise.
+  void track_objects(std::vector<IncrementalClusters::Cluster> &clusters, bool changed, const ros::Time &stamp);
 
 private:
   ros::NodeHandle nh_;
   ros::Subscriber sub_to_imaging_sonar_;
   ros::Subscriber sub_to_dvl_;
+  // Pings and the DVL are handled on ingest_queue_ by their own thread, and the timer and services on nh_'s queue, so
+  // publishing the pointcloud, the bounds service call and clustering can't delay or drop pings
+  ros::CallbackQueue ingest_queue_;
+  boost::scoped_ptr<ros::AsyncSpinner> ingest_spinner_;
+  // Guards points_ and clusters_
+  boost::mutex points_mutex_;
+  // Guards the grids, dirty_ and keyframe state, voxels_, mat_origin_ and window_
+  boost::mutex ogrid_mutex_;
 
   tf::TransformListener listener_;
 
@@ -95,35 +133,85 @@ private:
 
   // Publish ogrid and pointclouds
   ros::Publisher pub_grid_;
+  ros::Publisher pub_grid_updates_;
+  ros::Publisher pub_grid_deltas_;
   ros::Publisher pub_point_cloud_filtered_;
   ros::Publisher pub_point_cloud_raw_;
   ros::Publisher pub_point_cloud_plane_;
   ros::Publisher pub_markers_;
   ros::Publisher pub_objects_;
+  ros::Publisher pub_voxels_;
 
   ros::ServiceServer clear_pcl_service_;
   ros::ServiceServer clear_ogrid_service_;
   ros::ServiceServer get_objects_service_;
   ros::Timer timer_;
 
-  // A CV_32F Mat to store probability of occupied/unoccupied spaces
+  // A CV_16S Mat to store log-odds of occupied/unoccupied spaces, see LogOdds.hpp
   cv::Mat persistant_ogrid_;
-  float hit_prob_;
+  // With tiled_, the log-odds are kept in tiled_ogrid_ instead and neither persistant_ogrid_ nor mat_ogrid_ is
+  // allocated; the published ogrid is rasterized from the tiles
+  bool tiled_;
+  TiledOgrid tiled_ogrid_;
+  int16_t hit_log_odds_;
+  // Scratch space for process_persistant_ogrid
+  std::vector<int> hit_cells_;
 
   cv::Mat mat_ogrid_;
+  // persistant_ogrid_ and mat_ogrid_ are ring buffers, window_ maps ogrid cells onto them. Unless rolling_window_ is
+  // set the ogrid stays where it was centered when the sub was unkilled, and the offset stays 0.
+  RollingWindow window_;
+  bool rolling_window_;
+  // With rolling_window_, how far the sub may get from the ogrid's center before the ogrid follows it
+  float scroll_distance_;
+  // Cells of persistant_ogrid_ changed since mat_ogrid_ was last published
+  cv::Rect dirty_;
+  // A full ogrid is published every keyframe_period_, or on the next ping when the origin changes
+  ros::Duration keyframe_period_;
+  ros::Time last_keyframe_;
+  bool keyframe_needed_;
   float ogrid_size_;
   float resolution_;
   double dvl_range_;
   int min_intensity_;
 
+  // Sonar hits by 3D voxel, so obstacles can be told apart by depth
+  subjugator::VoxelMap voxels_;
+  int voxel_min_hits_;
+  // A voxel became occupied or the voxels were cleared since they were last published
+  bool voxels_changed_;
+
   ros::ServiceClient service_get_bounds_;
   tf::StampedTransform transform_;
 
-  // Storage container for the pointcloud
-  boost::circular_buffer<pcl::PointXYZI> point_cloud_buffer_;
-  pcl::PointCloud<pcl::PointXYZI>::Ptr pointCloud_;
+  // The sonar returns so far, one point per voxel. Publishing and filtering work on its snapshots, taken by the timer
+  // only when point_cloud/raw is subscribed or in debug, so they don't hold the lock or copy the points.
+  boost::scoped_ptr<PointStore> points_;
+  double point_max_age_;
+  // The Euclidean clusters of points_, updated as voxels are added, moved by new returns and evicted
+  IncrementalClusters clusters_;
+  // Voxels were added, moved or removed since the timer last took the clusters of clusters_
+  bool clusters_changed_;
+  // Scratch space for forget_removed_points
+  std::vector<uint64_t> removed_points_;
+  // The objects clusters_ has shown so far, matched every timer tick. get_objects answers with objects_, the table as
+  // of the last tick, so it neither clusters nor waits for the tick. Both are guarded by objects_mutex_.
+  ObjectTracker tracker_;
+  boost::shared_ptr<const mil_msgs::PerceptionObjectArray> objects_;
+  boost::mutex objects_mutex_;
 
   std::vector<cv::Point> bounds_;
 
   Classification classification_;
+  PingConverter ping_converter_;
+};
+
+// Runs OGridGen inside a nodelet manager, so other nodelets in it (like the c3_trajectory_generator) receive the ogrid
+// without it being serialized. The ogrid_generator executable loads it standalone.
+class OGridGenNodelet : public nodelet::Nodelet
+{
+private:
+  void onInit() override;
+
+  boost::scoped_ptr<OGridGen> ogrid_gen_;
 };
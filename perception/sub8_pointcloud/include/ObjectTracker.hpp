@@ -0,0 +1,49 @@
+#pragma once
+#include <pcl/point_types.h>
+
+#include <cstdint>
+#include <vector>
+
+#include <IncrementalClusters.hpp>
+
+// A table of the objects the sonar's clusters have shown, which keep their ids from one set of clusters to the next.
+// Each set is matched to the table by centroid, closest pairs first: a cluster within match_distance of an object is
+// that object again, and one that isn't is a new object with a new id. An object without a cluster is dropped once it
+// hasn't had one for max_age seconds. When clusters merge, the merged cluster keeps the id of the closest of them.
+class ObjectTracker
+{
+public:
+  struct Object
+  {
+    uint32_t id;
+    pcl::PointXYZ centroid;
+    // Bounding box of the points
+    pcl::PointXYZ min, max;
+    std::vector<pcl::PointXYZI> points;
+    // Seconds
+    double first_seen, last_seen;
+  };
+
+  explicit ObjectTracker(float match_distance = 1, double max_age = 0);
+
+  // Usage: Match the clusters seen at stamp (seconds) to the objects, taking their points
+  void update(std::vector<IncrementalClusters::Cluster> &clusters, double stamp);
+
+  // Usage: Drop the objects that haven't had a cluster for max_age seconds at stamp, as update does, for when the
+  // clusters haven't changed. Returns whether any were dropped.
+  bool expire(double stamp);
+
+  // Usage: Forget every object. Ids are not reused.
+  void clear();
+
+  const std::vector<Object> &objects() const
+  {
+    return objects_;
+  }
+
+private:
+  float match_distance_;
+  double max_age_;
+  uint32_t next_id_ = 0;
+  std::vector<Object> objects_;
+};
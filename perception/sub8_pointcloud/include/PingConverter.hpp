@@ -0,0 +1,44 @@
+#pragma once
+#include <Eigen/Core>
+
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cstdint>
+#include <vector>
+
+// Converts the returns of a sonar ping to points in the map frame, a whole ping at a time. A sonar head's bearings are
+// the same every ping, so their cos and sin are kept in tables per set of bearings, found by a hash of the bearings
+// and confirmed by comparing them, and a ping is converted in one branch free pass the compiler can vectorize, then compacted.
+class PingConverter
+{
+public:
+  // How many bearing sets are remembered before the tables are dropped and rebuilt
+  static const size_t MAX_TABLES = 8;
+
+  // Usage: Append to cloud the returns with an intensity above min_intensity, at least min_range from the sonar and
+  // no lower than min_z once rotated by rotation and moved by translation (sonar to map). Returns how many there were.
+  size_t convert(const std::vector<float> &bearings, const std::vector<float> &ranges,
+                 const std::vector<uint16_t> &intensities, int min_intensity, float min_range,
+                 const Eigen::Matrix3f &rotation, const Eigen::Vector3f &translation, float min_z,
+                 pcl::PointCloud<pcl::PointXYZI> &cloud);
+
+private:
+  struct Table
+  {
+    uint64_t hash;
+    std::vector<float> bearings;
+    std::vector<float> cos;
+    std::vector<float> sin;
+  };
+
+  std::vector<Table> tables_;
+  // Index in tables_ of the last ping's bearings
+  size_t last_ = 0;
+  // Scratch space for convert, the points in the map frame and whether to keep them
+  std::vector<float> x_, y_, z_;
+  std::vector<uint8_t> keep_;
+  std::vector<uint32_t> kept_;
+
+  const Table &table(const std::vector<float> &bearings);
+};
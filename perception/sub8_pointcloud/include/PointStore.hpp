@@ -0,0 +1,91 @@
+#pragma once
+#include <pcl/point_cloud.h>
+#include <pcl/point_types.h>
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Sonar returns kept as one point per voxel: the mean position and intensity of the returns that fell in it, how many
+// there were and when the last one was. Repeated returns from the same spot cost nothing more, so a mission's worth of
+// returns fits in max_voxels points, and voxels that haven't been seen for a while can be evicted.
+//
+// The points are one pcl::PointCloud, shared with snapshots until the store next changes, when it copies them first if
+// a snapshot is still held. Taking a snapshot is free, and a snapshot that is let go of before the next change (once
+// published to subscribers in other processes, or filtered) costs nothing. One held longer (by a subscriber in the
+// same process) costs one copy on the next change, after which the store's points are its own again until the next
+// snapshot.
+class PointStore
+{
+public:
+  PointStore(float resolution, size_t max_voxels, const std::string &frame_id);
+
+  float resolution() const
+  {
+    return resolution_;
+  }
+
+  size_t size() const
+  {
+    return cloud_->points.size();
+  }
+
+  // Usage: Add a return seen at stamp (seconds), returns the index of its voxel. If the store is full, the oldest tenth
+  // of it (by rank, however many share a stamp) is evicted first.
+  size_t add(const pcl::PointXYZI &point, double stamp);
+
+  // Usage: Remove the voxels last seen before stamp, returns how many
+  size_t evict_older_than(double stamp);
+
+  void clear();
+
+  const pcl::PointXYZI &point(size_t i) const
+  {
+    return cloud_->points[i];
+  }
+
+  // Usage: The points as they are now, which never change afterwards
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr snapshot() const
+  {
+    return cloud_;
+  }
+
+  // Usage: Move the keys of the voxels removed since the last call into removed, so what follows the store can drop them
+  void take_removed(std::vector<uint64_t> &removed);
+
+  // Per voxel, in the order of the points. A key identifies a voxel for as long as it is kept.
+  const std::vector<uint64_t> &keys() const
+  {
+    return keys_;
+  }
+  const std::vector<uint32_t> &hits() const
+  {
+    return hits_;
+  }
+  const std::vector<double> &last_seen() const
+  {
+    return last_seen_;
+  }
+
+private:
+  float resolution_;
+  size_t max_voxels_;
+  pcl::PointCloud<pcl::PointXYZI>::Ptr cloud_;
+  std::vector<uint32_t> hits_;
+  std::vector<double> last_seen_;
+  std::vector<uint64_t> keys_;
+  std::vector<uint64_t> removed_;
+  // Voxel key to index in cloud_
+  std::unordered_map<uint64_t, uint32_t> index_;
+  // Scratch space for evict_oldest
+  std::vector<uint32_t> order_;
+
+  uint64_t key(const pcl::PointXYZI &point) const;
+  // Copy cloud_ if a snapshot still holds it
+  void unshare();
+  // Remove the count voxels seen longest ago
+  void evict_oldest(size_t count);
+  // Move the last voxel into i's place
+  void remove(size_t i);
+};
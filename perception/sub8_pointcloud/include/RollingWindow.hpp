@@ -0,0 +1,86 @@
+#pragma once
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <cstdlib>
+
+// Maps the cells of a window that scrolls over the map onto fixed size, ring buffered Mats. Window cell (x, y) is
+// stored at ((x + offset.x) mod width, (y + offset.y) mod height), so scrolling the window only moves offset and
+// clears the cells that scroll in. With offset (0, 0) window and storage are the same.
+class RollingWindow
+{
+public:
+  explicit RollingWindow(cv::Size size = cv::Size()) : size(size), offset(0, 0)
+  {
+  }
+
+  cv::Size size;
+  cv::Point offset;
+
+  // Usage: Storage column of window column x, for x in [0, size.width)
+  int wrap_x(int x) const
+  {
+    x += offset.x;
+    return x >= size.width ? x - size.width : x;
+  }
+
+  // Usage: Storage row of window row y, for y in [0, size.height)
+  int wrap_y(int y) const
+  {
+    y += offset.y;
+    return y >= size.height ? y - size.height : y;
+  }
+
+  // Usage: Call f(storage_rect, window_tl) for each of the up to four contiguous pieces of storage that window rect
+  // (clipped to the window) is split into, with window_tl the window cell at storage_rect's top left
+  template <typename F>
+  void for_each_part(cv::Rect rect, F f) const
+  {
+    rect &= cv::Rect(cv::Point(0, 0), size);
+    if (rect.area() == 0)
+      return;
+    // Window coordinate at which storage wraps back to 0
+    int split_x = size.width - offset.x;
+    int split_y = size.height - offset.y;
+    int xs[3] = { rect.x, std::min(std::max(split_x, rect.x), rect.x + rect.width), rect.x + rect.width };
+    int ys[3] = { rect.y, std::min(std::max(split_y, rect.y), rect.y + rect.height), rect.y + rect.height };
+    for (int j = 0; j < 2; ++j)
+    {
+      for (int i = 0; i < 2; ++i)
+      {
+        if (xs[i + 1] == xs[i] || ys[j + 1] == ys[j])
+          continue;
+        cv::Point window_tl(xs[i], ys[j]);
+        f(cv::Rect(cv::Point(wrap_x(xs[i]), wrap_y(ys[j])), cv::Size(xs[i + 1] - xs[i], ys[j + 1] - ys[j])), window_tl);
+      }
+    }
+  }
+
+  // Usage: Move the window by shift cells, so what was window cell (x, y) becomes (x - shift.x, y - shift.y), and call
+  // clear(storage_rect) for the pieces of storage that now hold cells that scrolled in
+  template <typename F>
+  void scroll(cv::Point shift, F clear)
+  {
+    if (std::abs(shift.x) >= size.width || std::abs(shift.y) >= size.height)
+    {
+      offset = cv::Point(0, 0);
+      clear(cv::Rect(cv::Point(0, 0), size));
+      return;
+    }
+    offset.x = (offset.x + shift.x + size.width) % size.width;
+    offset.y = (offset.y + shift.y + size.height) % size.height;
+
+    // Columns that scrolled in, then the rows that did (the corner they share only once)
+    cv::Rect columns = shift.x > 0 ? cv::Rect(size.width - shift.x, 0, shift.x, size.height) :
+                                     cv::Rect(0, 0, -shift.x, size.height);
+    cv::Rect rows = shift.y > 0 ? cv::Rect(0, size.height - shift.y, size.width, shift.y) :
+                                  cv::Rect(0, 0, size.width, -shift.y);
+    auto clear_part = [&](const cv::Rect &part, const cv::Point &) { clear(part); };
+    for_each_part(columns, clear_part);
+    if (rows.area() == 0)
+      return;
+    rows.x = shift.x > 0 ? 0 : -shift.x;
+    rows.width = size.width - std::abs(shift.x);
+    for_each_part(rows, clear_part);
+  }
+};
@@ -0,0 +1,128 @@
+#pragma once
+#include <opencv2/core/core.hpp>
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// A CV_16S log-odds ogrid (see LogOdds.hpp) kept as a coarse grid of TILE x TILE cell tiles. A tile whose cells all
+// have the same value is stored as that value alone, and only gets its cells once one of them is set to something
+// else, so water that was never seen (unknown) or has been seen empty until it saturated (LOG_ODDS_MIN) takes a few
+// bytes per tile. Memory grows with the area around returns and the edges of what has been seen, not the arena's.
+class TiledOgrid
+{
+public:
+  static const int TILE_BITS = 5;
+  static const int TILE = 1 << TILE_BITS;
+
+  explicit TiledOgrid(cv::Size size = cv::Size());
+
+  cv::Size size() const
+  {
+    return size_;
+  }
+
+  int16_t get(int x, int y) const
+  {
+    const Tile &t = tile(x, y);
+    return t.cells ? t.cells[cell(x, y)] : t.value;
+  }
+
+  // Setting a uniform tile's cell to its value keeps it uniform
+  void set(int x, int y, int16_t value)
+  {
+    Tile &t = tile(x, y);
+    if (!t.cells)
+    {
+      if (t.value == value)
+        return;
+      expand(t);
+    }
+    t.cells[cell(x, y)] = value;
+  }
+
+  // Usage: Reference to a cell, giving its tile cells if it had none
+  int16_t &at(int x, int y)
+  {
+    Tile &t = tile(x, y);
+    if (!t.cells)
+      expand(t);
+    return t.cells[cell(x, y)];
+  }
+
+  // Set every cell to 0 (unknown) and free all tiles
+  void clear();
+
+  // Usage: Free the tiles overlapping rect whose cells have all become the same value
+  void compact(cv::Rect rect);
+
+  size_t tiles_expanded() const
+  {
+    return expanded_;
+  }
+
+  size_t memory_bytes() const
+  {
+    return tiles_.capacity() * sizeof(Tile) + expanded_ * TILE * TILE * sizeof(int16_t);
+  }
+
+  // Usage: Write classify(value) of every cell in rect (clipped to the ogrid) to out, rect.width per row, row_step
+  // apart. Uniform tiles are classified once per row span.
+  template <typename F>
+  void rasterize(cv::Rect rect, uchar *out, size_t row_step, F classify) const
+  {
+    rect &= cv::Rect(cv::Point(0, 0), size_);
+    for (int y = rect.y; y < rect.y + rect.height; ++y, out += row_step)
+    {
+      uchar *o = out;
+      for (int x = rect.x; x < rect.x + rect.width;)
+      {
+        const Tile &t = tile(x, y);
+        int end = std::min(rect.x + rect.width, (x & ~(TILE - 1)) + TILE);
+        if (t.cells)
+        {
+          const int16_t *c = &t.cells[cell(x, y)];
+          for (int i = x; i < end; ++i)
+            *o++ = classify(*c++);
+        }
+        else
+        {
+          std::fill(o, o + (end - x), classify(t.value));
+          o += end - x;
+        }
+        x = end;
+      }
+    }
+  }
+
+private:
+  struct Tile
+  {
+    // TILE * TILE cells, row major, or null if all are value
+    std::unique_ptr<int16_t[]> cells;
+    int16_t value = 0;
+  };
+
+  cv::Size size_;
+  int tiles_x_;
+  std::vector<Tile> tiles_;
+  size_t expanded_;
+
+  const Tile &tile(int x, int y) const
+  {
+    return tiles_[(y >> TILE_BITS) * tiles_x_ + (x >> TILE_BITS)];
+  }
+
+  Tile &tile(int x, int y)
+  {
+    return tiles_[(y >> TILE_BITS) * tiles_x_ + (x >> TILE_BITS)];
+  }
+
+  static int cell(int x, int y)
+  {
+    return ((y & (TILE - 1)) << TILE_BITS) | (x & (TILE - 1));
+  }
+
+  void expand(Tile &t);
+};
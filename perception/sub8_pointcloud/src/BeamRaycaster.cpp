@@ -0,0 +1,124 @@
+#include "BeamRaycaster.hpp"
+
+#include <algorithm>
+
+BeamRaycaster::BeamRaycaster()
+  : certainty(log_odds_from_probability(.95))
+  , uncertainty(log_odds_from_probability(.95))
+  , degrade(-log_odds_from_probability(.49))
+  , hit_buffer(5)
+{
+}
+
+// The cell is tracked as a pointer into storage, which wraps around its edges, and the window coordinates only for the
+// bounds check
+bool BeamRaycaster::cast(cv::Mat &ogrid, cv::Point start, cv::Point end, cv::Rect &dirty, cv::Point offset)
+{
+  const unsigned cols = ogrid.cols;
+  const unsigned rows = ogrid.rows;
+  if (unsigned(start.x) >= cols || unsigned(start.y) >= rows)
+    return false;
+
+  LineWalk walk(start, end);
+  const ptrdiff_t stride = ogrid.step1();
+  // Storage coordinates of the current cell
+  int px = (start.x + offset.x) % cols;
+  int py = (start.y + offset.y) % rows;
+  int16_t *cell = ogrid.ptr<int16_t>(py) + px;
+  auto move_x = [&]() {
+    px += walk.sx;
+    cell += walk.sx;
+    if (unsigned(px) >= cols)
+    {
+      px -= walk.sx * int(cols);
+      cell -= walk.sx * ptrdiff_t(cols);
+    }
+  };
+  auto move_y = [&]() {
+    py += walk.sy;
+    cell += walk.sy * stride;
+    if (unsigned(py) >= rows)
+    {
+      py -= walk.sy * int(rows);
+      cell -= walk.sy * stride * ptrdiff_t(rows);
+    }
+  };
+
+  front_.clear();
+  int i = 0;
+  for (; i <= walk.length(); ++i, walk.step(move_x, move_y))
+  {
+    if (unsigned(walk.x) >= cols || unsigned(walk.y) >= rows)
+      return false;
+    if (*cell > certainty)
+      break;
+    front_.push_back(cell);
+  }
+  if (i > walk.length())
+    return false;
+
+  for (int16_t *p : front_)
+  {
+    if (*p < uncertainty)
+      *p = log_odds_add(*p, -degrade);
+  }
+
+  cv::Point last(walk.x, walk.y);
+  for (int j = i; j <= walk.length(); ++j, walk.step(move_x, move_y))
+  {
+    if (unsigned(walk.x) >= cols || unsigned(walk.y) >= rows)
+      break;
+    if (j >= i + hit_buffer)
+    {
+      *cell = 0;
+      last = cv::Point(walk.x, walk.y);
+    }
+  }
+
+  dirty |= cv::Rect(cv::Point(std::min(start.x, last.x), std::min(start.y, last.y)),
+                    cv::Point(std::max(start.x, last.x) + 1, std::max(start.y, last.y) + 1));
+  return true;
+}
+
+bool BeamRaycaster::cast(TiledOgrid &ogrid, cv::Point start, cv::Point end, cv::Rect &dirty)
+{
+  const unsigned cols = ogrid.size().width;
+  const unsigned rows = ogrid.size().height;
+  if (unsigned(start.x) >= cols || unsigned(start.y) >= rows)
+    return false;
+
+  LineWalk walk(start, end);
+  front_cells_.clear();
+  int i = 0;
+  for (; i <= walk.length(); ++i, walk.step())
+  {
+    if (unsigned(walk.x) >= cols || unsigned(walk.y) >= rows)
+      return false;
+    int16_t value = ogrid.get(walk.x, walk.y);
+    if (value > certainty)
+      break;
+    if (value < uncertainty && log_odds_add(value, -degrade) != value)
+      front_cells_.emplace_back(cv::Point(walk.x, walk.y), log_odds_add(value, -degrade));
+  }
+  if (i > walk.length())
+    return false;
+
+  for (auto &c : front_cells_)
+    ogrid.set(c.first.x, c.first.y, c.second);
+
+  cv::Point last(walk.x, walk.y);
+  for (int j = i; j <= walk.length(); ++j, walk.step())
+  {
+    if (unsigned(walk.x) >= cols || unsigned(walk.y) >= rows)
+      break;
+    if (j >= i + hit_buffer)
+    {
+      ogrid.set(walk.x, walk.y, 0);
+      last = cv::Point(walk.x, walk.y);
+    }
+  }
+
+  dirty |= cv::Rect(cv::Point(std::min(start.x, last.x), std::min(start.y, last.y)),
+                    cv::Point(std::max(start.x, last.x) + 1, std::max(start.y, last.y) + 1));
+  return true;
+}
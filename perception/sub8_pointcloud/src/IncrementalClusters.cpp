@@ -0,0 +1,278 @@
+#include "IncrementalClusters.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// 21 bits per axis, as in the PointStore
+static const uint64_t CELL_MASK = (1 << 21) - 1;
+static const int CELL_OFFSET = 1 << 20;
+
+static uint64_t pack(int x, int y, int z)
+{
+  return (uint64_t(x + CELL_OFFSET) & CELL_MASK) << 42 | (uint64_t(y + CELL_OFFSET) & CELL_MASK) << 21 |
+         (uint64_t(z + CELL_OFFSET) & CELL_MASK);
+}
+
+static int unpack(uint64_t cell, int shift)
+{
+  return int((cell >> shift) & CELL_MASK) - CELL_OFFSET;
+}
+
+IncrementalClusters::IncrementalClusters(float tolerance) : tolerance_(tolerance)
+{
+}
+
+uint64_t IncrementalClusters::cell(const pcl::PointXYZI &point) const
+{
+  return pack(std::floor(point.x / tolerance_), std::floor(point.y / tolerance_), std::floor(point.z / tolerance_));
+}
+
+uint32_t IncrementalClusters::find(uint32_t n)
+{
+  while (nodes_[n].parent != n)
+  {
+    nodes_[n].parent = nodes_[nodes_[n].parent].parent;
+    n = nodes_[n].parent;
+  }
+  return n;
+}
+
+// Union by size. The circular lists are spliced by swapping the roots' next nodes.
+void IncrementalClusters::unite(uint32_t a, uint32_t b)
+{
+  a = find(a);
+  b = find(b);
+  if (a == b)
+    return;
+  if (aggregates_[a].size < aggregates_[b].size)
+    std::swap(a, b);
+  nodes_[b].parent = a;
+  std::swap(nodes_[a].next, nodes_[b].next);
+  roots_.erase(b);
+
+  Aggregate &into = aggregates_[a];
+  const Aggregate &from = aggregates_[b];
+  into.size += from.size;
+  into.x += from.x;
+  into.y += from.y;
+  into.z += from.z;
+  into.min = pcl::PointXYZ(std::min(into.min.x, from.min.x), std::min(into.min.y, from.min.y),
+                           std::min(into.min.z, from.min.z));
+  into.max = pcl::PointXYZ(std::max(into.max.x, from.max.x), std::max(into.max.y, from.max.y),
+                           std::max(into.max.z, from.max.z));
+  if (from.dirty)
+    mark_dirty(a);
+}
+
+bool IncrementalClusters::link(uint32_t n, const pcl::PointXYZI *old)
+{
+  bool broken = false;
+  const pcl::PointXYZI &p = nodes_[n].point;
+  const uint64_t c = nodes_[n].cell;
+  const int cx = unpack(c, 42), cy = unpack(c, 21), cz = unpack(c, 0);
+  const float tolerance_squared = tolerance_ * tolerance_;
+  for (int x = cx - 1; x <= cx + 1; ++x)
+  {
+    for (int y = cy - 1; y <= cy + 1; ++y)
+    {
+      for (int z = cz - 1; z <= cz + 1; ++z)
+      {
+        auto it = cells_.find(pack(x, y, z));
+        if (it == cells_.end())
+          continue;
+        for (uint32_t q : it->second)
+        {
+          const pcl::PointXYZI &o = nodes_[q].point;
+          const float dx = o.x - p.x, dy = o.y - p.y, dz = o.z - p.z;
+          if (q == n)
+            continue;
+          if (dx * dx + dy * dy + dz * dz <= tolerance_squared)
+          {
+            unite(n, q);
+          }
+          else if (old)
+          {
+            const float ox = o.x - old->x, oy = o.y - old->y, oz = o.z - old->z;
+            broken |= ox * ox + oy * oy + oz * oz <= tolerance_squared;
+          }
+        }
+      }
+    }
+  }
+  return broken;
+}
+
+void IncrementalClusters::reset(uint32_t n)
+{
+  Node &node = nodes_[n];
+  node.parent = n;
+  node.next = n;
+  const pcl::PointXYZ p(node.point.x, node.point.y, node.point.z);
+  aggregates_[n] = Aggregate{ 1, p.x, p.y, p.z, p, p, false };
+  roots_.insert(n);
+}
+
+void IncrementalClusters::remove_from_cell(uint32_t n)
+{
+  auto it = cells_.find(nodes_[n].cell);
+  std::vector<uint32_t> &nodes = it->second;
+  *std::find(nodes.begin(), nodes.end(), n) = nodes.back();
+  nodes.pop_back();
+  if (nodes.empty())
+    cells_.erase(it);
+}
+
+void IncrementalClusters::update(uint64_t id, const pcl::PointXYZI &point)
+{
+  auto it = index_.find(id);
+  if (it != index_.end())
+  {
+    // Leaving its cell is a remove and an add. Within it, the point is linked again from where it is now, and if it
+    // moved away from a neighbor the cluster may have to be split.
+    const uint32_t n = it->second;
+    if (cell(point) != nodes_[n].cell)
+    {
+      remove(id);
+    }
+    else
+    {
+      Node &node = nodes_[n];
+      Aggregate &a = aggregates_[find(n)];
+      a.x += point.x - node.point.x;
+      a.y += point.y - node.point.y;
+      a.z += point.z - node.point.z;
+      a.min = pcl::PointXYZ(std::min(a.min.x, point.x), std::min(a.min.y, point.y), std::min(a.min.z, point.z));
+      a.max = pcl::PointXYZ(std::max(a.max.x, point.x), std::max(a.max.y, point.y), std::max(a.max.z, point.z));
+      const pcl::PointXYZI old = node.point;
+      node.point = point;
+      if (link(n, &old))
+        mark_dirty(find(n));
+      return;
+    }
+  }
+
+  uint32_t n;
+  if (free_.empty())
+  {
+    n = nodes_.size();
+    nodes_.emplace_back();
+    aggregates_.emplace_back();
+  }
+  else
+  {
+    n = free_.back();
+    free_.pop_back();
+  }
+  index_.emplace(id, n);
+  nodes_[n].point = point;
+  nodes_[n].cell = cell(point);
+  nodes_[n].alive = true;
+  reset(n);
+  cells_[nodes_[n].cell].push_back(n);
+  link(n);
+}
+
+// The node stays in its cluster's list, and in the union-find, until the cluster is split
+void IncrementalClusters::remove(uint64_t id)
+{
+  auto it = index_.find(id);
+  if (it == index_.end())
+    return;
+  const uint32_t n = it->second;
+  index_.erase(it);
+  remove_from_cell(n);
+  Node &node = nodes_[n];
+  node.alive = false;
+  const uint32_t root = find(n);
+  Aggregate &a = aggregates_[root];
+  a.size -= 1;
+  a.x -= node.point.x;
+  a.y -= node.point.y;
+  a.z -= node.point.z;
+  mark_dirty(root);
+}
+
+void IncrementalClusters::mark_dirty(uint32_t root)
+{
+  if (!aggregates_[root].dirty)
+  {
+    aggregates_[root].dirty = true;
+    dirty_.push_back(root);
+  }
+}
+
+void IncrementalClusters::clear()
+{
+  nodes_.clear();
+  aggregates_.clear();
+  free_.clear();
+  index_.clear();
+  cells_.clear();
+  roots_.clear();
+  dirty_.clear();
+}
+
+// Every live point of the cluster is made a cluster of its own, then linked again. Their neighbors are all in the old
+// cluster, or they would have been linked already.
+void IncrementalClusters::split(uint32_t root)
+{
+  members_.clear();
+  uint32_t n = root;
+  do
+  {
+    members_.push_back(n);
+    n = nodes_[n].next;
+  } while (n != root);
+  roots_.erase(root);
+
+  for (uint32_t m : members_)
+  {
+    if (nodes_[m].alive)
+    {
+      reset(m);
+    }
+    else
+    {
+      nodes_[m].parent = m;
+      aggregates_[m].dirty = false;
+      free_.push_back(m);
+    }
+  }
+  for (uint32_t m : members_)
+  {
+    if (nodes_[m].alive)
+      link(m);
+  }
+}
+
+void IncrementalClusters::clusters(size_t min_size, size_t max_size, std::vector<Cluster> &out)
+{
+  // A root split or freed earlier in the loop is no longer dirty
+  for (size_t i = 0; i < dirty_.size(); ++i)
+  {
+    const uint32_t d = dirty_[i];
+    if (nodes_[d].parent == d && aggregates_[d].dirty)
+      split(d);
+  }
+  dirty_.clear();
+
+  out.clear();
+  for (uint32_t root : roots_)
+  {
+    const Aggregate &a = aggregates_[root];
+    if (a.size < min_size || a.size > max_size)
+      continue;
+    out.emplace_back();
+    Cluster &c = out.back();
+    c.centroid = pcl::PointXYZ(a.x / a.size, a.y / a.size, a.z / a.size);
+    c.min = a.min;
+    c.max = a.max;
+    c.points.reserve(a.size);
+    uint32_t n = root;
+    do
+    {
+      c.points.push_back(nodes_[n].point);
+      n = nodes_[n].next;
+    } while (n != root);
+  }
+}
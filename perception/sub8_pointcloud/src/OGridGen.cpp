@@ -4,20 +4,32 @@
 
 ogrid_param params;
 
-OGridGen::OGridGen()
-  : nh_(ros::this_node::getName())
+// What a cell of the published ogrid is, from its log-odds
+static uchar classify_cell(int16_t log_odds)
+{
+  static const int16_t occupied = log_odds_from_probability(.8);
+  static const int16_t unoccupied = log_odds_from_probability(.1);
+  return log_odds > occupied ? (uchar)WAYPOINT_ERROR_TYPE::OCCUPIED :
+                               log_odds < unoccupied ? (uchar)WAYPOINT_ERROR_TYPE::UNOCCUPIED :
+                                                       (uchar)WAYPOINT_ERROR_TYPE::UNKNOWN;
+}
+
+OGridGen::OGridGen(const ros::NodeHandle &nh)
+  : nh_(nh)
   , kill_listener_(nh_, "kill")
   , was_killed_(true)
   , classification_(&nh_)
-  , pointCloud_(new pcl::PointCloud<pcl::PointXYZI>())
 {
   // The publishers
   pub_grid_ = nh_.advertise<nav_msgs::OccupancyGrid>("ogrid", 10, true);
+  pub_grid_updates_ = nh_.advertise<map_msgs::OccupancyGridUpdate>("ogrid_updates", 10);
+  pub_grid_deltas_ = nh_.advertise<c3_trajectory_generator::OgridUpdate>("ogrid_deltas", 10);
   pub_point_cloud_filtered_ = nh_.advertise<pcl::PointCloud<pcl::PointXYZI>>("point_cloud/filtered", 1);
   pub_point_cloud_raw_ = nh_.advertise<pcl::PointCloud<pcl::PointXYZI>>("point_cloud/raw", 1);
   pub_point_cloud_plane_ = nh_.advertise<pcl::PointCloud<pcl::PointXYZI>>("point_cloud/plane", 1);
   pub_markers_ = nh_.advertise<visualization_msgs::MarkerArray>("markers", 1);
   pub_objects_ = nh_.advertise<mil_msgs::PerceptionObjectArray>("objects", 1);
+  pub_voxels_ = nh_.advertise<c3_trajectory_generator::OccupiedVoxels>("voxels", 1, true);
   clear_ogrid_service_ = nh_.advertiseService("clear_ogrid", &OGridGen::clear_ogrid_callback, this);
   clear_pcl_service_ = nh_.advertiseService("clear_pcl", &OGridGen::clear_pcl_callback, this);
   get_objects_service_ = nh_.advertiseService("get_objects", &OGridGen::get_objects_callback, this);
@@ -26,6 +38,32 @@ OGridGen::OGridGen()
   // Resolution is meters/pixel
   nh_.param<float>("resolution", resolution_, 0.2f);
   nh_.param<float>("ogrid_size", ogrid_size_, 91.44);
+  // Keep the ogrid centered on the sub, scrolling it in whole meters once the sub is scroll_distance from its center
+  nh_.param<bool>("rolling_window", rolling_window_, false);
+  nh_.param<float>("scroll_distance", scroll_distance_, ogrid_size_ / 8);
+  if (rolling_window_ && std::abs(1 / resolution_ - std::round(1 / resolution_)) > 1e-3)
+    throw std::runtime_error("rolling_window needs a whole number of cells per meter");
+  // Only keep fine cells where the ogrid is not all the same, for large ogrids or fine resolutions
+  nh_.param<bool>("tiled_ogrid", tiled_, false);
+  if (tiled_ && rolling_window_)
+    throw std::runtime_error("tiled_ogrid and rolling_window can't be used together");
+  // Probability that a cell with a sonar return in it is occupied, applied once per cell per ping
+  double hit_probability;
+  nh_.param<double>("hit_probability", hit_probability, 0.65);
+  hit_log_odds_ = log_odds_from_probability(hit_probability);
+  // hit_prob was added to a cell per return, hit_probability is a probability and not interchangeable with it
+  if (nh_.hasParam("hit_prob"))
+    ROS_WARN("hit_prob is no longer used, set hit_probability (a probability, now %.2f) instead", hit_probability);
+  // Between full ogrids only the changed cells are published on ogrid_deltas (and ogrid_updates)
+  double keyframe_period;
+  nh_.param<double>("keyframe_period", keyframe_period, 2.0);
+  keyframe_period_ = ros::Duration(keyframe_period);
+  // Voxels are published as occupied once they have been hit voxel_min_hits times
+  double voxel_resolution;
+  nh_.param<double>("voxel_resolution", voxel_resolution, 0.2);
+  nh_.param<int>("voxel_min_hits", voxel_min_hits_, 5);
+  voxels_ = subjugator::VoxelMap(voxel_resolution);
+  voxels_changed_ = true;
   // Ignore points that are below the potential pool
   nh_.param<int>("min_intensity", min_intensity_, 2000);
   nh_.param<float>("statistical_mean_k", params.statistical_mean_k, 75);
@@ -38,23 +76,40 @@ OGridGen::OGridGen()
   nh_.param<bool>("debug", params.debug, false);
   dvl_range_ = 0;
 
-  // Buffer that will only hold a certain amount of points
-  int point_cloud_buffer_Size;
-  nh_.param<int>("buffer_size", point_cloud_buffer_Size, 5000);
-  point_cloud_buffer_.set_capacity(point_cloud_buffer_Size);
+  // Returns are kept as one point per point_resolution voxel, at most buffer_size of them, and dropped once they haven't
+  // been seen for point_max_age seconds (never if 0)
+  int buffer_size;
+  nh_.param<int>("buffer_size", buffer_size, 5000);
+  float point_resolution;
+  nh_.param<float>("point_resolution", point_resolution, 0.1);
+  nh_.param<double>("point_max_age", point_max_age_, 0);
+  points_.reset(new PointStore(point_resolution, buffer_size, "map"));
+  clusters_ = IncrementalClusters(params.cluster_tolerance_m);
+  // A cluster within object_match_distance of an object is that object again, and objects without a cluster are
+  // forgotten after object_max_age seconds
+  float object_match_distance;
+  double object_max_age;
+  nh_.param<float>("object_match_distance", object_match_distance, 1);
+  nh_.param<double>("object_max_age", object_max_age, 0);
+  tracker_ = ObjectTracker(object_match_distance, object_max_age);
+  clusters_changed_ = true;
+  objects_.reset(new mil_msgs::PerceptionObjectArray());
 
   // TODO: Publish bounds
   service_get_bounds_ = nh_.serviceClient<sub8_msgs::Bounds>("get_bounds");
 
-  // Run the publisher
-  timer_ =
-      nh_.createTimer(ros::Duration(0.3), std::bind(&OGridGen::publish_big_pointcloud, this, std::placeholders::_1));
-  sub_to_imaging_sonar_ = nh_.subscribe("/blueview_driver/ranges", 1, &OGridGen::callback, this);
-  sub_to_dvl_ = nh_.subscribe("/dvl/range", 1, &OGridGen::dvl_callback, this);
-
-  mat_ogrid_ = cv::Mat::zeros(int(ogrid_size_ / resolution_), int(ogrid_size_ / resolution_), CV_8U);
-  persistant_ogrid_ = cv::Mat(int(ogrid_size_) / resolution_, int(ogrid_size_ / resolution_), CV_32FC1);
-  persistant_ogrid_ = 0.5;
+  cv::Size ogrid_cells(ogrid_size_ / resolution_, ogrid_size_ / resolution_);
+  if (tiled_)
+  {
+    tiled_ogrid_ = TiledOgrid(ogrid_cells);
+  }
+  else
+  {
+    mat_ogrid_ = cv::Mat::zeros(ogrid_cells, CV_8U);
+    persistant_ogrid_ = cv::Mat::zeros(ogrid_cells, CV_16SC1);
+  }
+  window_ = RollingWindow(ogrid_cells);
+  mark_all_dirty();
 
   // Make sure alarm integration is ok
   kill_listener_.waitForConnection(ros::Duration(2));
@@ -63,6 +118,22 @@ OGridGen::OGridGen()
   kill_listener_.start();
 
   mat_origin_ = cv::Point(0, 0);
+
+  // Run the publisher
+  timer_ =
+      nh_.createTimer(ros::Duration(0.3), std::bind(&OGridGen::publish_big_pointcloud, this, std::placeholders::_1));
+  // Only start taking pings once everything they use is set up
+  ros::NodeHandle ingest_nh(nh_);
+  ingest_nh.setCallbackQueue(&ingest_queue_);
+  sub_to_imaging_sonar_ = ingest_nh.subscribe("/blueview_driver/ranges", 1, &OGridGen::callback, this);
+  sub_to_dvl_ = ingest_nh.subscribe("/dvl/range", 1, &OGridGen::dvl_callback, this);
+  ingest_spinner_.reset(new ros::AsyncSpinner(1, &ingest_queue_));
+  ingest_spinner_->start();
+}
+
+OGridGen::~OGridGen()
+{
+  ingest_spinner_->stop();
 }
 
 void OGridGen::dvl_callback(const mil_msgs::RangeStampedConstPtr &dvl)
@@ -71,7 +142,7 @@ void OGridGen::dvl_callback(const mil_msgs::RangeStampedConstPtr &dvl)
 }
 /*
   Looped based on timer_.
-  Reads point_cloud_buffer_ and publishes a PointCloud2
+  Reads points_ and publishes a PointCloud2
   Reads mat_ogrid_ and publish a OccupencyGrid
 */
 void OGridGen::publish_big_pointcloud(const ros::TimerEvent &)
@@ -85,35 +156,70 @@ void OGridGen::publish_big_pointcloud(const ros::TimerEvent &)
     // Populate bounds_ with the data from service call
     for (auto &p : get_bound_data.response.bounds)
     {
-      bounds_.push_back(cv::Point(p.x / resolution_ + mat_ogrid_.cols / 2, p.y / resolution_ + mat_ogrid_.rows / 2));
+      bounds_.push_back(
+          cv::Point(p.x / resolution_ + window_.size.width / 2, p.y / resolution_ + window_.size.height / 2));
     }
 
-    // Convert bounds_ vector to an array of array and use openCV function to draw a polygon
-    const cv::Point *pts = (const cv::Point *)cv::Mat(bounds_).data;
-    int npts = cv::Mat(bounds_).rows;
-    cv::polylines(mat_ogrid_, &pts, &npts, 1, true, 255, 3, CV_8U, 0);
+    // Draw the bounds into a mask and copy it onto the ogrid, whose storage may wrap. The next ping rethresholds these
+    // cells before they are published, as it always has, so mark them dirty.
+    cv::Rect bounds_rect = cv::boundingRect(bounds_);
+    bounds_rect = cv::Rect(bounds_rect.tl() - cv::Point(2, 2), bounds_rect.br() + cv::Point(2, 2)) &
+                  cv::Rect(cv::Point(0, 0), window_.size);
+    // A tiled ogrid has no mat_ogrid_ to draw on
+    if (!tiled_ && bounds_rect.area() > 0)
+    {
+      boost::mutex::scoped_lock lock(ogrid_mutex_);
+      cv::Mat mask = cv::Mat::zeros(bounds_rect.size(), CV_8U);
+      std::vector<cv::Point> polyline;
+      for (auto &p : bounds_)
+        polyline.push_back(p - bounds_rect.tl());
+      const cv::Point *pts = polyline.data();
+      int npts = polyline.size();
+      cv::polylines(mask, &pts, &npts, 1, true, 255, 3, CV_8U, 0);
+      window_.for_each_part(bounds_rect, [&](const cv::Rect &part, const cv::Point &window_tl) {
+        mat_ogrid_(part).setTo(255, mask(cv::Rect(window_tl - bounds_rect.tl(), part.size())));
+      });
+      dirty_ |= bounds_rect;
+    }
   }
 
-  // Populate a PCL pointcloud using the point_cloud_buffer_
-  pointCloud_->clear();
-  pointCloud_->reserve(point_cloud_buffer_.capacity());
-  for (auto &p : point_cloud_buffer_)
+  // Drop the old returns and take a snapshot of the rest if they will be published, which is not a copy and never
+  // changes afterwards. The next ping only copies the points if the snapshot is still held by then.
+  const bool publish_points = pub_point_cloud_raw_.getNumSubscribers() > 0 || params.debug;
+  pcl::PointCloud<pcl::PointXYZI>::ConstPtr pointCloud;
+  std::vector<IncrementalClusters::Cluster> found_clusters;
+  bool clusters_changed;
   {
-    pointCloud_->push_back(p);
+    boost::mutex::scoped_lock lock(points_mutex_);
+    if (point_max_age_ > 0)
+    {
+      points_->evict_older_than(ros::Time::now().toSec() - point_max_age_);
+      forget_removed_points();
+    }
+    if (publish_points)
+      pointCloud = points_->snapshot();
+    // Only when a ping or eviction changed them, the objects are then as they were
+    clusters_changed = clusters_changed_;
+    clusters_changed_ = false;
+    if (clusters_changed)
+      clusters_.clusters(params.cluster_min_num_points, params.cluster_max_num_points, found_clusters);
   }
 
-  // Publish the raw point cloud
-  pointCloud_->header.frame_id = "map";
-  pcl_conversions::toPCL(ros::Time::now(), pointCloud_->header.stamp);
-  pub_point_cloud_raw_.publish(pointCloud_);
-
+  // Publish the raw point cloud, and let go of the snapshot before anything else
+  if (pointCloud)
+    pub_point_cloud_raw_.publish(pointCloud);
   if (params.debug)
   {
-    // For debugging a snapshot of current point cloud and filter it and show objects
-    pcl::PointCloud<pcl::PointXYZI>::Ptr pointCloud_filtered = classification_.filtered(pointCloud_);
+    // For debugging filter the snapshot
+    pcl::PointCloud<pcl::PointXYZI>::Ptr pointCloud_filtered = classification_.filtered(pointCloud);
     pub_point_cloud_filtered_.publish(pointCloud_filtered);
-    cluster(pointCloud_filtered);
   }
+  pointCloud.reset();
+
+  track_objects(found_clusters, clusters_changed, ros::Time::now());
+
+  if (params.ogrid)
+    publish_voxels();
 }
 
 /*
@@ -130,142 +236,326 @@ void OGridGen::callback(const mil_blueview_driver::BlueViewPingPtr &ping_msg)
     ROS_DEBUG_STREAM("Did not get TF for imaging sonar");
     return;
   }
-  if (kill_listener_.isRaised())
-    was_killed_ = true;
-  else if (was_killed_)
-  {
-    was_killed_ = false;
-    mat_origin_ = cv::Point(transform_.getOrigin().x(), transform_.getOrigin().y());
-  }
-
+  // Returns above min_intensity_, beyond nearby_threshold and above depth, in the map frame
   pcl::PointCloud<pcl::PointXYZI>::Ptr point_cloud_plane(new pcl::PointCloud<pcl::PointXYZI>());
-  for (size_t i = 0; i < ping_msg->ranges.size(); ++i)
+  const tf::Matrix3x3 &basis = transform_.getBasis();
+  Eigen::Matrix3f rotation;
+  for (int row = 0; row < 3; ++row)
+    rotation.row(row) << basis[row].x(), basis[row].y(), basis[row].z();
+  Eigen::Vector3f translation(transform_.getOrigin().x(), transform_.getOrigin().y(), transform_.getOrigin().z());
+  ping_converter_.convert(ping_msg->bearings, ping_msg->ranges, ping_msg->intensities, min_intensity_,
+                          params.nearby_threshold, rotation, translation, -params.depth, *point_cloud_plane);
   {
-    if (ping_msg->intensities.at(i) > min_intensity_)
-    {  // TODO: Better thresholding
-
-      // Get x and y of a ping. RIGHT TRIANGLES
-      double x_d = ping_msg->ranges.at(i) * cos(ping_msg->bearings.at(i));
-      double y_d = ping_msg->ranges.at(i) * sin(ping_msg->bearings.at(i));
-      if (std::hypot(x_d, y_d) < params.nearby_threshold)
-        continue;
-
-      // Rotate point using TF
-      tf::Vector3 vec = tf::Vector3(x_d, y_d, 0);
-      tf::Vector3 newVec = transform_.getBasis() * vec;
-
-      // Shift point relative to sub's location
-      pcl::PointXYZI point;
-      point.x = newVec.x() + transform_.getOrigin().x();
-      point.y = newVec.y() + transform_.getOrigin().y();
-      point.z = newVec.z() + transform_.getOrigin().z();
-      // Ignore points if they are below some depth in map frame
-      if (point.z < -params.depth)
-        continue;
-      point.intensity = ping_msg->intensities.at(i);
-      point_cloud_buffer_.push_back(point);
-      point_cloud_plane->push_back(point);
+    boost::mutex::scoped_lock lock(points_mutex_);
+    double stamp = ros::Time::now().toSec();
+    for (auto &point : point_cloud_plane->points)
+    {
+      size_t i = points_->add(point, stamp);
+      // Adding may have evicted old voxels
+      forget_removed_points();
+      clusters_.update(points_->keys()[i], points_->point(i));
+      clusters_changed_ = true;
     }
   }
   point_cloud_plane->header.frame_id = "map";
   pcl_conversions::toPCL(ros::Time::now(), point_cloud_plane->header.stamp);
   pub_point_cloud_plane_.publish(point_cloud_plane);
 
+  // The rest works on the ogrid, which the timer and the clear_ogrid service also touch
+  boost::mutex::scoped_lock lock(ogrid_mutex_);
+  if (kill_listener_.isRaised())
+    was_killed_ = true;
+  else if (was_killed_)
+  {
+    was_killed_ = false;
+    cv::Point origin(transform_.getOrigin().x(), transform_.getOrigin().y());
+    if (rolling_window_)
+      scroll_to(origin);
+    else
+      mat_origin_ = origin;
+    keyframe_needed_ = true;
+  }
+  if (rolling_window_ && (std::abs(transform_.getOrigin().x() - mat_origin_.x) > scroll_distance_ ||
+                          std::abs(transform_.getOrigin().y() - mat_origin_.y) > scroll_distance_))
+    scroll_to(cv::Point(std::round(transform_.getOrigin().x()), std::round(transform_.getOrigin().y())));
+
   if (params.ogrid)
   {
+    // The published voxels only change when one reaches voxel_min_hits
+    for (auto &point : point_cloud_plane->points)
+      voxels_changed_ |= voxels_.add(point.x, point.y, point.z) == std::max(1, voxel_min_hits_);
     process_persistant_ogrid(point_cloud_plane);
-    populate_mat_ogrid();
+    // The sector the sonar looked at, whether or not anything in it was above min_intensity_
+    float min_bearing = 0, max_bearing = 0, max_range = 0;
+    if (!ping_msg->bearings.empty())
+    {
+      auto bearings = std::minmax_element(ping_msg->bearings.begin(), ping_msg->bearings.end());
+      min_bearing = *bearings.first;
+      max_bearing = *bearings.second;
+      max_range = *std::max_element(ping_msg->ranges.begin(), ping_msg->ranges.end());
+    }
+    populate_mat_ogrid(min_bearing, max_bearing, max_range);
     publish_ogrid();
   }
 }
-void OGridGen::populate_mat_ogrid()
+void OGridGen::mark_all_dirty()
+{
+  dirty_ = cv::Rect(cv::Point(0, 0), window_.size);
+  keyframe_needed_ = true;
+}
+
+// The cells that are still in the ogrid keep their storage, only the window's offset moves and the cells that scroll
+// in are cleared to unknown
+void OGridGen::scroll_to(const cv::Point &origin)
+{
+  const int cells_per_meter = std::round(1 / resolution_);
+  cv::Point shift = (origin - mat_origin_) * cells_per_meter;
+  mat_origin_ = origin;
+  if (shift == cv::Point(0, 0))
+    return;
+  window_.scroll(shift, [&](const cv::Rect &part) {
+    persistant_ogrid_(part).setTo(0);
+    mat_ogrid_(part).setTo((uchar)WAYPOINT_ERROR_TYPE::UNKNOWN);
+  });
+  dirty_ = cv::Rect(dirty_.tl() - shift, dirty_.size()) & cv::Rect(cv::Point(0, 0), mat_ogrid_.size());
+  // The published ogrid has moved, so updates relative to the last one would land in the wrong place
+  keyframe_needed_ = true;
+}
+
+void OGridGen::populate_mat_ogrid(float min_bearing, float max_bearing, float max_range)
 {
-  classification_.zonify(persistant_ogrid_, resolution_, transform_, mat_origin_);
-  for (int i = 0; i < persistant_ogrid_.cols; ++i)
+  if (tiled_)
   {
-    for (int j = 0; j < persistant_ogrid_.rows; ++j)
+    // Beams through water that is already as free as it gets leave their tiles uniform, the rest may have become so
+    dirty_ |= classification_.zonify(tiled_ogrid_, resolution_, transform_, mat_origin_, min_bearing, max_bearing,
+                                     max_range);
+    dirty_ &= cv::Rect(cv::Point(0, 0), window_.size);
+    tiled_ogrid_.compact(dirty_);
+    return;
+  }
+
+  dirty_ |= classification_.zonify(persistant_ogrid_, resolution_, transform_, mat_origin_, min_bearing, max_bearing,
+                                   max_range, window_.offset);
+  dirty_ &= cv::Rect(cv::Point(0, 0), mat_ogrid_.size());
+  window_.for_each_part(dirty_, [&](const cv::Rect &part, const cv::Point &) {
+    for (int j = part.y; j < part.y + part.height; ++j)
     {
-      float val = persistant_ogrid_.at<float>(cv::Point(i, j));
-      if (val > .8)
-        mat_ogrid_.at<uchar>(cv::Point(i, j)) = (uchar)WAYPOINT_ERROR_TYPE::OCCUPIED;
-      else if (val < .1)
-        mat_ogrid_.at<uchar>(cv::Point(i, j)) = (uchar)WAYPOINT_ERROR_TYPE::UNOCCUPIED;
-      else
-        mat_ogrid_.at<uchar>(cv::Point(i, j)) = (uchar)WAYPOINT_ERROR_TYPE::UNKNOWN;
+      const int16_t *in = persistant_ogrid_.ptr<int16_t>(j);
+      uchar *out = mat_ogrid_.ptr<uchar>(j);
+      for (int i = part.x; i < part.x + part.width; ++i)
+        out[i] = classify_cell(in[i]);
     }
-  }
+  });
 }
 
 void OGridGen::publish_ogrid()
 {
-  // Flatten the mat_ogrid_ into a 1D vector for OccupencyGrid message
-  nav_msgs::OccupancyGrid rosGrid;
-  std::vector<int8_t> data(mat_ogrid_.cols * mat_ogrid_.rows);
-  auto out_it = data.begin();
-  for (int row = 0; row < mat_ogrid_.rows; ++row)
+  ros::Time now = ros::Time::now();
+  if (!keyframe_needed_ && now - last_keyframe_ < keyframe_period_)
+  {
+    publish_ogrid_update(now);
+    return;
+  }
+  keyframe_needed_ = false;
+  last_keyframe_ = now;
+  dirty_ = cv::Rect();
+
+  // Published as a shared pointer and never touched again, so subscribers in the same nodelet manager get it
+  // without a copy and only subscribers in other processes cause it to be serialized
+  nav_msgs::OccupancyGridPtr rosGrid(new nav_msgs::OccupancyGrid);
+
+  // Flatten the mat_ogrid_ into a 1D vector for OccupencyGrid message, unrolling the ring buffer
+  const cv::Size size = window_.size;
+  rosGrid->data.resize(size.area());
+  if (tiled_)
   {
-    auto *p = mat_ogrid_.ptr(row);
-    for (int col = 0; col < mat_ogrid_.cols; ++col)
+    tiled_ogrid_.rasterize(cv::Rect(cv::Point(0, 0), size), (uchar *)rosGrid->data.data(), size.width, classify_cell);
+  }
+  else
+  {
+    auto out_it = rosGrid->data.begin();
+    for (int row = 0; row < size.height; ++row)
     {
-      *out_it = int(*p++);
-      out_it++;
+      const uchar *p = mat_ogrid_.ptr(window_.wrap_y(row));
+      out_it = std::copy(p + window_.offset.x, p + size.width, out_it);
+      out_it = std::copy(p, p + window_.offset.x, out_it);
     }
   }
 
   // Publish the ogrid
-  rosGrid.header.seq = 0;
-  rosGrid.info.resolution = resolution_;
-  rosGrid.header.frame_id = "map";
-  rosGrid.header.stamp = ros::Time::now();
-  rosGrid.info.map_load_time = ros::Time::now();
-  rosGrid.info.width = mat_ogrid_.cols;
-  rosGrid.info.height = mat_ogrid_.rows;
-  rosGrid.info.origin.position.x = mat_origin_.x - ogrid_size_ / 2;
-  rosGrid.info.origin.position.y = mat_origin_.y - ogrid_size_ / 2;
-  rosGrid.data = data;
-  pub_grid_.publish(rosGrid);
+  rosGrid->header.seq = 0;
+  rosGrid->info.resolution = resolution_;
+  rosGrid->header.frame_id = "map";
+  rosGrid->header.stamp = now;
+  rosGrid->info.map_load_time = now;
+  rosGrid->info.width = size.width;
+  rosGrid->info.height = size.height;
+  rosGrid->info.origin.position.x = mat_origin_.x - ogrid_size_ / 2;
+  rosGrid->info.origin.position.y = mat_origin_.y - ogrid_size_ / 2;
+  pub_grid_.publish(nav_msgs::OccupancyGridConstPtr(rosGrid));
 }
 
-void OGridGen::process_persistant_ogrid(pcl::PointCloud<pcl::PointXYZI>::Ptr point_cloud_plane)
+void OGridGen::publish_ogrid_update(const ros::Time &stamp)
 {
-  nh_.param<float>("hit_prob", hit_prob_, 0.1);
+  if (dirty_.area() == 0)
+    return;
 
-  for (auto &point_pcl : point_cloud_plane->points)
+  // Tagged with the ogrid it applies to, a subscriber could get this before the ogrid or the last ones after it
+  c3_trajectory_generator::OgridUpdatePtr update(new c3_trajectory_generator::OgridUpdate);
+  update->header.frame_id = "map";
+  update->header.stamp = stamp;
+  update->keyframe = last_keyframe_;
+  update->x = dirty_.x;
+  update->y = dirty_.y;
+  update->width = dirty_.width;
+  update->height = dirty_.height;
+  update->data.resize(dirty_.area());
+  if (tiled_)
   {
-    // Check if point is inside the potential ogrid
-    cv::Rect rect(cv::Point(0, 0), persistant_ogrid_.size());
-    cv::Point p(point_pcl.x / resolution_ + persistant_ogrid_.cols / 2 - mat_origin_.x / resolution_,
-                point_pcl.y / resolution_ + persistant_ogrid_.rows / 2 - mat_origin_.y / resolution_);
-    if (rect.contains(p))
-    {
-      if (persistant_ogrid_.at<float>(p.y, p.x) < 1)
+    tiled_ogrid_.rasterize(dirty_, (uchar *)update->data.data(), dirty_.width, classify_cell);
+  }
+  else
+  {
+    window_.for_each_part(dirty_, [&](const cv::Rect &part, const cv::Point &window_tl) {
+      for (int j = 0; j < part.height; ++j)
       {
-        persistant_ogrid_.at<float>(p.y, p.x) += hit_prob_;
+        const uchar *p = mat_ogrid_.ptr(part.y + j) + part.x;
+        std::copy(p, p + part.width,
+                  update->data.begin() + (window_tl.y - dirty_.y + j) * dirty_.width + window_tl.x - dirty_.x);
       }
-    }
+    });
+  }
+  dirty_ = cv::Rect();
+
+  if (pub_grid_updates_.getNumSubscribers() > 0)
+  {
+    map_msgs::OccupancyGridUpdatePtr rviz_update(new map_msgs::OccupancyGridUpdate);
+    rviz_update->header = update->header;
+    rviz_update->x = update->x;
+    rviz_update->y = update->y;
+    rviz_update->width = update->width;
+    rviz_update->height = update->height;
+    rviz_update->data = update->data;
+    pub_grid_updates_.publish(map_msgs::OccupancyGridUpdateConstPtr(rviz_update));
+  }
+  pub_grid_deltas_.publish(c3_trajectory_generator::OgridUpdateConstPtr(update));
+}
+
+// Only when the occupied voxels changed, subscribers keep the last (latched) message until then
+void OGridGen::publish_voxels()
+{
+  // Copying the table is quicker than building the message from it, so pings are only held up for the copy
+  subjugator::VoxelMap voxels;
+  {
+    boost::mutex::scoped_lock lock(ogrid_mutex_);
+    if (!voxels_changed_)
+      return;
+    voxels_changed_ = false;
+    voxels = voxels_;
+  }
+  c3_trajectory_generator::OccupiedVoxelsPtr msg(new c3_trajectory_generator::OccupiedVoxels);
+  msg->header.frame_id = "map";
+  msg->header.stamp = ros::Time::now();
+  msg->resolution = voxels.resolution();
+  msg->indices.reserve(3 * voxels.size());
+  voxels.for_each([&](int i, int j, int k, uint16_t hits) {
+    if (hits < voxel_min_hits_)
+      return;
+    msg->indices.push_back(i);
+    msg->indices.push_back(j);
+    msg->indices.push_back(k);
+  });
+  pub_voxels_.publish(c3_trajectory_generator::OccupiedVoxelsConstPtr(msg));
+}
+
+// Each cell with returns in it gets one hit per ping, however many returns it has, so the cell index of every point is
+// found first, then deduplicated, then every cell is updated once
+void OGridGen::process_persistant_ogrid(pcl::PointCloud<pcl::PointXYZI>::Ptr point_cloud_plane)
+{
+  const int cols = window_.size.width;
+  const int rows = window_.size.height;
+  const float scale = 1 / resolution_;
+  const float offset_x = cols / 2 - mat_origin_.x / resolution_;
+  const float offset_y = rows / 2 - mat_origin_.y / resolution_;
+  const std::vector<pcl::PointXYZI, Eigen::aligned_allocator<pcl::PointXYZI>> &points = point_cloud_plane->points;
+
+  // Cells outside of the ogrid get index -1, the others their index in the window, not in storage
+  hit_cells_.resize(points.size());
+  for (size_t n = 0; n < points.size(); ++n)
+  {
+    int x = std::floor(points[n].x * scale + offset_x);
+    int y = std::floor(points[n].y * scale + offset_y);
+    hit_cells_[n] = x >= 0 && x < cols && y >= 0 && y < rows ? y * cols + x : -1;
   }
+  std::sort(hit_cells_.begin(), hit_cells_.end());
+  auto begin = std::upper_bound(hit_cells_.begin(), hit_cells_.end(), -1);
+  auto end = std::unique(begin, hit_cells_.end());
+  if (begin == end)
+    return;
+
+  // persistant_ogrid_ is continuous, being allocated in one piece
+  int16_t *cells = persistant_ogrid_.ptr<int16_t>();
+  int min_x = cols, max_x = -1;
+  for (auto it = begin; it != end; ++it)
+  {
+    int x = *it % cols;
+    int16_t &cell = tiled_ ? tiled_ogrid_.at(x, *it / cols) :
+                             cells[window_.wrap_y(*it / cols) * cols + window_.wrap_x(x)];
+    cell = log_odds_add(cell, hit_log_odds_);
+    min_x = std::min(min_x, x);
+    max_x = std::max(max_x, x);
+  }
+  // Sorted by index, so the rows are already in order
+  dirty_ |= cv::Rect(cv::Point(min_x, *begin / cols), cv::Point(max_x + 1, *(end - 1) / cols + 1));
+}
+
+void OGridGen::forget_removed_points()
+{
+  points_->take_removed(removed_points_);
+  for (uint64_t key : removed_points_)
+    clusters_.remove(key);
+  if (!removed_points_.empty())
+    clusters_changed_ = true;
 }
 
-mil_msgs::PerceptionObjectArray OGridGen::cluster(pcl::PointCloud<pcl::PointXYZI>::Ptr pc)
+/*
+  Match the clusters to the tracked objects, then publish them and make them what get_objects answers with. Clusters
+  that didn't change only age the objects, which are republished as they were unless some expired.
+*/
+void OGridGen::track_objects(std::vector<IncrementalClusters::Cluster> &clusters, bool changed,
+                             const ros::Time &stamp)
 {
-  int id = 0;
+  if (!changed)
+  {
+    boost::mutex::scoped_lock lock(objects_mutex_);
+    if (!tracker_.expire(stamp.toSec()))
+    {
+      boost::shared_ptr<const mil_msgs::PerceptionObjectArray> objects = objects_;
+      lock.unlock();
+      pub_objects_.publish(objects);
+      return;
+    }
+  }
+
+
   visualization_msgs::MarkerArray markers;
-  mil_msgs::PerceptionObjectArray objects;
-  // Cluster points into objects
-  std::vector<pcl::PointIndices> cluster_indices = classification_.clustering(pc);
+  boost::shared_ptr<mil_msgs::PerceptionObjectArray> objects(new mil_msgs::PerceptionObjectArray());
+  // Object ids only grow, so markers of objects that are gone have to be deleted
+  visualization_msgs::Marker delete_all;
+  delete_all.header.frame_id = "map";
+  delete_all.action = visualization_msgs::Marker::DELETEALL;
+  markers.markers.push_back(delete_all);
+
+  boost::mutex::scoped_lock lock(objects_mutex_);
+  if (changed)
+    tracker_.update(clusters, stamp.toSec());
 
   // Iterate objects
-  for (auto it = cluster_indices.begin(); it != cluster_indices.end(); ++it)
+  for (auto &tracked : tracker_.objects())
   {
     mil_msgs::PerceptionObject object;
-    pcl::CentroidPoint<pcl::PointXYZI> centroid;
-    pcl::PointCloud<pcl::PointXYZI>::Ptr cloud_cluster(new pcl::PointCloud<pcl::PointXYZI>);
-    for (std::vector<int>::const_iterator pit = it->indices.begin(); pit != it->indices.end(); ++pit)
+    for (auto &p : tracked.points)
     {
-      auto p = pc->points[*pit];
-      cloud_cluster->push_back(p);
-      centroid.add(pc->points[*pit]);
-
       // Add point to object's array
       geometry_msgs::Point32 geo_p;
       geo_p.x = p.x;
@@ -273,18 +563,13 @@ mil_msgs::PerceptionObjectArray OGridGen::cluster(pcl::PointCloud<pcl::PointXYZI
       geo_p.z = p.z;
       object.points.emplace_back(geo_p);
     }
-    cloud_cluster->width = static_cast<uint32_t>(cloud_cluster->points.size());
-    cloud_cluster->height = 1;
-    cloud_cluster->is_dense = true;
-    pcl::PointXYZI minPt, maxPt;
-    pcl::getMinMax3D(*cloud_cluster, minPt, maxPt);
-
-    pcl::PointXYZI c;
-    centroid.get(c);
+    const pcl::PointXYZ &minPt = tracked.min, &maxPt = tracked.max;
+    const pcl::PointXYZ &c = tracked.centroid;
 
     // Init object header
-    object.header.stamp = ros::Time::now();
+    object.header.stamp = ros::Time(tracked.last_seen);
     object.header.frame_id = "map";
+    object.id = tracked.id;
     object.classification = "object";
     object.labeled_classification = "unknown";
     object.pose.position.x = c.x;
@@ -294,11 +579,11 @@ mil_msgs::PerceptionObjectArray OGridGen::cluster(pcl::PointCloud<pcl::PointXYZI
     object.scale.x = maxPt.x - minPt.x;
     object.scale.y = maxPt.y - minPt.y;
     object.scale.z = maxPt.z - minPt.z;
-    objects.objects.push_back(object);
+    objects->objects.push_back(object);
 
     visualization_msgs::Marker marker;
     marker.header.frame_id = "map";
-    marker.id = id++;
+    marker.id = tracked.id;
     marker.type = visualization_msgs::Marker::SPHERE;
     marker.pose.position.x = c.x;
     marker.pose.position.y = c.y;
@@ -310,42 +595,63 @@ mil_msgs::PerceptionObjectArray OGridGen::cluster(pcl::PointCloud<pcl::PointXYZI
     marker.color.b = 1.0;
     markers.markers.push_back(marker);
   }
+  objects_ = objects;
+  lock.unlock();
 
+  pub_objects_.publish(objects);
   pub_markers_.publish(markers);
-  return objects;
 }
 
 bool OGridGen::clear_ogrid_callback(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
 {
-  persistant_ogrid_ = 0.5;
+  boost::mutex::scoped_lock lock(ogrid_mutex_);
+  if (tiled_)
+    tiled_ogrid_.clear();
+  else
+    persistant_ogrid_.setTo(0);
+  mark_all_dirty();
+  voxels_.clear();
+  voxels_changed_ = true;
   res.success = true;
   return true;
 }
 
 bool OGridGen::clear_pcl_callback(std_srvs::Trigger::Request &req, std_srvs::Trigger::Response &res)
 {
-  point_cloud_buffer_.clear();
+  boost::mutex::scoped_lock lock(points_mutex_);
+  points_->clear();
+  points_->take_removed(removed_points_);
+  clusters_.clear();
+  clusters_changed_ = true;
+  lock.unlock();
+  boost::mutex::scoped_lock objects_lock(objects_mutex_);
+  tracker_.clear();
+  objects_.reset(new mil_msgs::PerceptionObjectArray());
   res.success = true;
   return true;
 }
 
+// Answers with the objects as of the last timer tick, which keep their ids between calls
 bool OGridGen::get_objects_callback(mil_msgs::ObjectDBQuery::Request &req, mil_msgs::ObjectDBQuery::Response &res)
 {
-  pcl::PointCloud<pcl::PointXYZI>::Ptr pointCloud_filtered = classification_.filtered(pointCloud_);
-  if (pointCloud_filtered->size() < 1)
+  boost::shared_ptr<const mil_msgs::PerceptionObjectArray> objects;
+  {
+    boost::mutex::scoped_lock lock(objects_mutex_);
+    objects = objects_;
+  }
+  if (objects->objects.empty())
   {
     res.found = false;
     return false;
   }
-  mil_msgs::PerceptionObjectArray objects = cluster(pointCloud_filtered);
   res.found = true;
-  res.objects = objects.objects;
+  res.objects = objects->objects;
   return true;
 }
 
-int main(int argc, char **argv)
+void OGridGenNodelet::onInit()
 {
-  ros::init(argc, argv, "ogrid_pointcloud");
-  OGridGen oGridGen;
-  ros::spin();
+  ogrid_gen_.reset(new OGridGen(getPrivateNodeHandle()));
 }
+
+PLUGINLIB_EXPORT_CLASS(OGridGenNodelet, nodelet::Nodelet)
@@ -0,0 +1,81 @@
+#include "ObjectTracker.hpp"
+
+#include <algorithm>
+#include <tuple>
+
+ObjectTracker::ObjectTracker(float match_distance, double max_age) : match_distance_(match_distance), max_age_(max_age)
+{
+}
+
+// Every cluster is compared with every object, there are only ever tens of them
+void ObjectTracker::update(std::vector<IncrementalClusters::Cluster> &clusters, double stamp)
+{
+  // Squared distance, cluster, object
+  std::vector<std::tuple<float, size_t, size_t>> pairs;
+  for (size_t c = 0; c < clusters.size(); ++c)
+  {
+    for (size_t o = 0; o < objects_.size(); ++o)
+    {
+      const pcl::PointXYZ &a = clusters[c].centroid, &b = objects_[o].centroid;
+      const float distance = (a.x - b.x) * (a.x - b.x) + (a.y - b.y) * (a.y - b.y) + (a.z - b.z) * (a.z - b.z);
+      if (distance <= match_distance_ * match_distance_)
+        pairs.emplace_back(distance, c, o);
+    }
+  }
+  std::sort(pairs.begin(), pairs.end());
+
+  std::vector<bool> cluster_matched(clusters.size(), false), object_matched(objects_.size(), false);
+  auto take = [&](Object &object, IncrementalClusters::Cluster &cluster) {
+    object.centroid = cluster.centroid;
+    object.min = cluster.min;
+    object.max = cluster.max;
+    object.points.swap(cluster.points);
+    object.last_seen = stamp;
+  };
+  for (auto &pair : pairs)
+  {
+    const size_t c = std::get<1>(pair), o = std::get<2>(pair);
+    if (cluster_matched[c] || object_matched[o])
+      continue;
+    cluster_matched[c] = object_matched[o] = true;
+    take(objects_[o], clusters[c]);
+  }
+
+  // Drop the stale objects before adding the new ones, which are all matched
+  size_t kept = 0;
+  for (size_t o = 0; o < objects_.size(); ++o)
+  {
+    if (object_matched[o] || stamp - objects_[o].last_seen < max_age_)
+    {
+      if (kept != o)
+        objects_[kept] = std::move(objects_[o]);
+      ++kept;
+    }
+  }
+  objects_.resize(kept);
+
+  for (size_t c = 0; c < clusters.size(); ++c)
+  {
+    if (cluster_matched[c])
+      continue;
+    objects_.emplace_back();
+    Object &object = objects_.back();
+    object.id = next_id_++;
+    object.first_seen = stamp;
+    take(object, clusters[c]);
+  }
+}
+
+bool ObjectTracker::expire(double stamp)
+{
+  const size_t before = objects_.size();
+  objects_.erase(std::remove_if(objects_.begin(), objects_.end(),
+                                [&](const Object &object) { return stamp - object.last_seen >= max_age_; }),
+                 objects_.end());
+  return objects_.size() != before;
+}
+
+void ObjectTracker::clear()
+{
+  objects_.clear();
+}
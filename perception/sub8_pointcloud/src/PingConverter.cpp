@@ -0,0 +1,124 @@
+#include "PingConverter.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+// FNV-1a over the number of bearings and the bits of up to SAMPLES of them, evenly spaced and including the first and
+// last. It only picks the table to compare the bearings with, so sampling them is enough to tell heads apart, and the
+// comparison is a memcmp of a few kilobytes, far less than the cos and sin it saves.
+static const size_t SAMPLES = 64;
+
+static uint64_t hash_bearings(const std::vector<float> &bearings)
+{
+  uint64_t hash = (14695981039346656037ull ^ bearings.size()) * 1099511628211ull;
+  size_t stride = std::max<size_t>(1, bearings.size() / SAMPLES);
+  for (size_t i = 0; i < bearings.size(); i += stride)
+  {
+    uint32_t bits;
+    std::memcpy(&bits, &bearings[i], sizeof(bits));
+    hash = (hash ^ bits) * 1099511628211ull;
+  }
+  uint32_t bits;
+  std::memcpy(&bits, &bearings.back(), sizeof(bits));
+  return (hash ^ bits) * 1099511628211ull;
+}
+
+const PingConverter::Table &PingConverter::table(const std::vector<float> &bearings)
+{
+  uint64_t hash = hash_bearings(bearings);
+  // Bitwise, as the hash is
+  auto same = [&](const Table &t) {
+    return t.hash == hash && t.bearings.size() == bearings.size() &&
+           std::memcmp(t.bearings.data(), bearings.data(), bearings.size() * sizeof(float)) == 0;
+  };
+  if (last_ < tables_.size() && same(tables_[last_]))
+    return tables_[last_];
+  for (last_ = 0; last_ < tables_.size(); ++last_)
+  {
+    if (same(tables_[last_]))
+      return tables_[last_];
+  }
+
+  if (tables_.size() >= MAX_TABLES)
+    tables_.clear();
+  Table t;
+  t.hash = hash;
+  t.bearings = bearings;
+  t.cos.resize(bearings.size());
+  t.sin.resize(bearings.size());
+  for (size_t i = 0; i < bearings.size(); ++i)
+  {
+    t.cos[i] = std::cos(bearings[i]);
+    t.sin[i] = std::sin(bearings[i]);
+  }
+  tables_.push_back(std::move(t));
+  last_ = tables_.size() - 1;
+  return tables_[last_];
+}
+
+// The sonar's returns lie in its xy plane, so only the first two columns of the rotation are used. Every return is
+// converted and tested, whether or not it is kept, so the loop has no branches. The arrays are restrict so the compiler
+// knows the byte stores to keep don't alias the rest, which it otherwise has to assume and won't vectorize.
+static void transform_returns(size_t n, const float *__restrict cos, const float *__restrict sin,
+                              const float *__restrict range, const uint16_t *__restrict intensity,
+                              const Eigen::Matrix3f &rotation, const Eigen::Vector3f &translation, int min_intensity,
+                              float min_range, float min_z, float *__restrict x, float *__restrict y,
+                              float *__restrict z, uint8_t *__restrict keep)
+{
+  const float r00 = rotation(0, 0), r01 = rotation(0, 1);
+  const float r10 = rotation(1, 0), r11 = rotation(1, 1);
+  const float r20 = rotation(2, 0), r21 = rotation(2, 1);
+  const float tx = translation.x(), ty = translation.y(), tz = translation.z();
+  for (size_t i = 0; i < n; ++i)
+  {
+    const float sonar_x = range[i] * cos[i];
+    const float sonar_y = range[i] * sin[i];
+    x[i] = r00 * sonar_x + r01 * sonar_y + tx;
+    y[i] = r10 * sonar_x + r11 * sonar_y + ty;
+    z[i] = r20 * sonar_x + r21 * sonar_y + tz;
+    keep[i] = (int(intensity[i]) > min_intensity) & (std::abs(range[i]) >= min_range) & (z[i] >= min_z);
+  }
+}
+
+// The indices of the kept points are gathered advancing by whether each was kept, instead of branching on it, then
+// only those are copied out
+size_t PingConverter::convert(const std::vector<float> &bearings, const std::vector<float> &ranges,
+                              const std::vector<uint16_t> &intensities, int min_intensity, float min_range,
+                              const Eigen::Matrix3f &rotation, const Eigen::Vector3f &translation, float min_z,
+                              pcl::PointCloud<pcl::PointXYZI> &cloud)
+{
+  const size_t n = std::min(bearings.size(), std::min(ranges.size(), intensities.size()));
+  if (n == 0)
+    return 0;
+  const Table &t = table(bearings);
+  x_.resize(n);
+  y_.resize(n);
+  z_.resize(n);
+  keep_.resize(n);
+  kept_.resize(n);
+  transform_returns(n, t.cos.data(), t.sin.data(), ranges.data(), intensities.data(), rotation, translation,
+                    min_intensity, min_range, min_z, x_.data(), y_.data(), z_.data(), keep_.data());
+
+  size_t kept = 0;
+  for (size_t i = 0; i < n; ++i)
+  {
+    kept_[kept] = i;
+    kept += keep_[i];
+  }
+
+  const size_t first = cloud.points.size();
+  cloud.points.resize(first + kept);
+  for (size_t k = 0; k < kept; ++k)
+  {
+    pcl::PointXYZI &p = cloud.points[first + k];
+    const uint32_t i = kept_[k];
+    p.x = x_[i];
+    p.y = y_[i];
+    p.z = z_[i];
+    p.intensity = intensities[i];
+  }
+  cloud.width = cloud.points.size();
+  cloud.height = 1;
+  return kept;
+}
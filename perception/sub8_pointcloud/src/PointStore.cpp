@@ -0,0 +1,138 @@
+#include "PointStore.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+
+PointStore::PointStore(float resolution, size_t max_voxels, const std::string &frame_id)
+  : resolution_(resolution), max_voxels_(std::max<size_t>(1, max_voxels)), cloud_(new pcl::PointCloud<pcl::PointXYZI>)
+{
+  cloud_->header.frame_id = frame_id;
+  cloud_->height = 1;
+  index_.reserve(max_voxels_);
+}
+
+// 21 bits per axis, as in the c3_trajectory_generator's VoxelMap
+uint64_t PointStore::key(const pcl::PointXYZI &point) const
+{
+  const uint64_t mask = (1 << 21) - 1;
+  const int offset = 1 << 20;
+  return (uint64_t(int(std::floor(point.x / resolution_)) + offset) & mask) << 42 |
+         (uint64_t(int(std::floor(point.y / resolution_)) + offset) & mask) << 21 |
+         (uint64_t(int(std::floor(point.z / resolution_)) + offset) & mask);
+}
+
+void PointStore::unshare()
+{
+  if (cloud_.use_count() > 1)
+    cloud_.reset(new pcl::PointCloud<pcl::PointXYZI>(*cloud_));
+}
+
+// The position and intensity are running means, so a voxel's point stays where most of its returns were
+size_t PointStore::add(const pcl::PointXYZI &point, double stamp)
+{
+  unshare();
+  cloud_->header.stamp = uint64_t(stamp * 1e6);
+  uint64_t k = key(point);
+  auto it = index_.find(k);
+  if (it == index_.end())
+  {
+    if (size() >= max_voxels_)
+      evict_oldest(std::max<size_t>(1, max_voxels_ / 10));
+    index_.emplace(k, size());
+    cloud_->points.push_back(point);
+    cloud_->width = size();
+    hits_.push_back(1);
+    last_seen_.push_back(stamp);
+    keys_.push_back(k);
+    return size() - 1;
+  }
+  else
+  {
+    size_t i = it->second;
+    pcl::PointXYZI &p = cloud_->points[i];
+    float weight = 1.f / ++hits_[i];
+    p.x += (point.x - p.x) * weight;
+    p.y += (point.y - p.y) * weight;
+    p.z += (point.z - p.z) * weight;
+    p.intensity += (point.intensity - p.intensity) * weight;
+    last_seen_[i] = std::max(last_seen_[i], stamp);
+    return i;
+  }
+}
+
+size_t PointStore::evict_older_than(double stamp)
+{
+  size_t before = size();
+  if (std::none_of(last_seen_.begin(), last_seen_.end(), [stamp](double t) { return t < stamp; }))
+    return 0;
+  unshare();
+  for (size_t i = 0; i < size();)
+  {
+    if (last_seen_[i] < stamp)
+      remove(i);
+    else
+      ++i;
+  }
+  return before - size();
+}
+
+// By rank rather than by a stamp threshold, which evicts nothing when most voxels share the threshold's stamp and
+// then has to be repeated on every add. Removing the highest indices first leaves the lower ones where they were.
+void PointStore::evict_oldest(size_t count)
+{
+  count = std::min(count, size());
+  order_.resize(size());
+  for (size_t i = 0; i < order_.size(); ++i)
+    order_[i] = i;
+  std::nth_element(order_.begin(), order_.begin() + count, order_.end(),
+                   [this](uint32_t a, uint32_t b) { return last_seen_[a] < last_seen_[b]; });
+  std::sort(order_.begin(), order_.begin() + count, std::greater<uint32_t>());
+  for (size_t i = 0; i < count; ++i)
+    remove(order_[i]);
+}
+
+void PointStore::take_removed(std::vector<uint64_t> &removed)
+{
+  removed.clear();
+  removed.swap(removed_);
+}
+
+void PointStore::clear()
+{
+  removed_.insert(removed_.end(), keys_.begin(), keys_.end());
+  // Nothing to copy if a snapshot still holds the points
+  if (cloud_.use_count() > 1)
+  {
+    pcl::PointCloud<pcl::PointXYZI>::Ptr empty(new pcl::PointCloud<pcl::PointXYZI>);
+    empty->header = cloud_->header;
+    empty->height = 1;
+    cloud_ = empty;
+  }
+  cloud_->points.clear();
+  cloud_->width = 0;
+  hits_.clear();
+  last_seen_.clear();
+  keys_.clear();
+  index_.clear();
+}
+
+void PointStore::remove(size_t i)
+{
+  size_t last = size() - 1;
+  index_.erase(keys_[i]);
+  removed_.push_back(keys_[i]);
+  if (i != last)
+  {
+    cloud_->points[i] = cloud_->points[last];
+    hits_[i] = hits_[last];
+    last_seen_[i] = last_seen_[last];
+    keys_[i] = keys_[last];
+    index_[keys_[i]] = i;
+  }
+  cloud_->points.pop_back();
+  cloud_->width = size();
+  hits_.pop_back();
+  last_seen_.pop_back();
+  keys_.pop_back();
+}
@@ -0,0 +1,60 @@
+#include "TiledOgrid.hpp"
+
+#include <algorithm>
+
+TiledOgrid::TiledOgrid(cv::Size size)
+  : size_(size)
+  , tiles_x_((size.width + TILE - 1) >> TILE_BITS)
+  , tiles_(tiles_x_ * ((size.height + TILE - 1) >> TILE_BITS))
+  , expanded_(0)
+{
+}
+
+void TiledOgrid::clear()
+{
+  for (Tile &t : tiles_)
+  {
+    t.cells.reset();
+    t.value = 0;
+  }
+  expanded_ = 0;
+}
+
+// Only the cells inside the ogrid are compared, the ones past its edge in the last row and column of tiles keep the
+// value the tile had when it was expanded
+void TiledOgrid::compact(cv::Rect rect)
+{
+  rect &= cv::Rect(cv::Point(0, 0), size_);
+  if (rect.area() == 0)
+    return;
+  for (int ty = rect.y >> TILE_BITS; ty <= (rect.y + rect.height - 1) >> TILE_BITS; ++ty)
+  {
+    for (int tx = rect.x >> TILE_BITS; tx <= (rect.x + rect.width - 1) >> TILE_BITS; ++tx)
+    {
+      Tile &t = tiles_[ty * tiles_x_ + tx];
+      if (!t.cells)
+        continue;
+      int width = std::min(TILE, size_.width - (tx << TILE_BITS));
+      int height = std::min(TILE, size_.height - (ty << TILE_BITS));
+      const int16_t value = t.cells[0];
+      bool uniform = true;
+      for (int y = 0; y < height && uniform; ++y)
+      {
+        const int16_t *row = &t.cells[y << TILE_BITS];
+        uniform = std::all_of(row, row + width, [value](int16_t c) { return c == value; });
+      }
+      if (!uniform)
+        continue;
+      t.cells.reset();
+      t.value = value;
+      --expanded_;
+    }
+  }
+}
+
+void TiledOgrid::expand(Tile &t)
+{
+  t.cells.reset(new int16_t[TILE * TILE]);
+  std::fill(t.cells.get(), t.cells.get() + TILE * TILE, t.value);
+  ++expanded_;
+}
@@ -0,0 +1,16 @@
+#include <nodelet/loader.h>
+#include <ros/ros.h>
+
+// Loads the ogrid generator nodelet on its own, the same as `rosrun nodelet nodelet standalone`
+int main(int argc, char **argv)
+{
+  ros::init(argc, argv, "ogrid_pointcloud");
+
+  nodelet::Loader loader(false);
+  nodelet::V_string nodelet_argv(argv + 1, argv + argc);
+  if (!loader.load(ros::this_node::getName(), "sub8_pointcloud/OGridGenNodelet", ros::names::getRemappings(),
+                   nodelet_argv))
+    return 1;
+
+  ros::spin();
+}
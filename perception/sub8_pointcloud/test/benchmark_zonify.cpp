@@ -0,0 +1,144 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+
+#include <opencv2/core/core.hpp>
+
+#include "BeamRaycaster.hpp"
+#include "TiledOgrid.hpp"
+
+// Prints the per-ping cost of raycasting the ogrid the way Classification::zonify used to (floating point rays every
+// 0.005 rad around the full circle, as long as the ogrid is wide) and with BeamRaycaster over the sonar's sector only,
+// on the dense ogrid and on a TiledOgrid (with how much of it ends up expanded as the sonar turns around).
+// Run against a Release (-O3) build:
+//   rosrun sub8_pointcloud zonify_benchmark [SECTOR_DEGREES] [MAX_RANGE_M]
+
+typedef std::chrono::steady_clock Clock;
+
+static const float RESOLUTION = 0.2;
+static const int SIZE = 750;
+
+// The old full-circle sweep, kept as the reference for the benchmark
+struct FullCircleSweep
+{
+  int16_t certainty;
+  int16_t uncertainty;
+  int degrade;
+  int hit_buffer;
+
+  void get_first_hit(cv::Mat &mat_ogrid, cv::Point2d start, float theta, int max_dis)
+  {
+    cv::Rect rect(cv::Point(0, 0), mat_ogrid.size());
+    cv::Point2d vec_d_theta(cos(theta), sin(theta));
+    for (int i = 0; i < max_dis; ++i)
+    {
+      cv::Point2d p_on_ray = vec_d_theta * i + start;
+      if (!rect.contains(p_on_ray))
+        return;
+      if (mat_ogrid.at<int16_t>(p_on_ray.y, p_on_ray.x) > certainty)
+      {
+        for (int j = i + hit_buffer; j < max_dis; ++j)
+        {
+          cv::Point2d cp_on_ray = vec_d_theta * j + start;
+          if (!rect.contains(cp_on_ray))
+            break;
+          mat_ogrid.at<int16_t>(cp_on_ray.y, cp_on_ray.x) = 0;
+        }
+        for (int j = 0; j < i; ++j)
+        {
+          cv::Point2d cp_on_ray = vec_d_theta * j + start;
+          if (!rect.contains(cp_on_ray))
+            break;
+          int16_t &cell = mat_ogrid.at<int16_t>(cp_on_ray.y, cp_on_ray.x);
+          if (cell < uncertainty)
+            cell = log_odds_add(cell, -degrade);
+        }
+        return;
+      }
+    }
+  }
+
+  void zonify(cv::Mat &mat_ogrid, cv::Point2d where_sub)
+  {
+    for (float d_theta = 0.f; d_theta <= 2 * CV_PI; d_theta += 0.005)
+      get_first_hit(mat_ogrid, where_sub, d_theta, mat_ogrid.cols);
+  }
+};
+
+// A pool's worth of obstacles: certain cells on a ring 15 m around the sub and scattered through the ogrid
+static cv::Mat make_ogrid()
+{
+  cv::Mat ogrid = cv::Mat::zeros(SIZE, SIZE, CV_16SC1);
+  std::mt19937 rng(1);
+  std::uniform_int_distribution<int> cell(0, SIZE - 1);
+  for (int k = 0; k < 2000; ++k)
+    ogrid.at<int16_t>(cell(rng), cell(rng)) = LOG_ODDS_MAX;
+  for (double a = 0; a < 2 * CV_PI; a += 0.01)
+    ogrid.at<int16_t>(SIZE / 2 + 15 / RESOLUTION * sin(a), SIZE / 2 + 15 / RESOLUTION * cos(a)) = LOG_ODDS_MAX;
+  return ogrid;
+}
+
+template <typename F>
+static double per_ping(F ping)
+{
+  cv::Mat original = make_ogrid();
+  cv::Mat ogrid;
+  double best = 1e9;
+  for (int r = 0; r < 20; ++r)
+  {
+    original.copyTo(ogrid);
+    Clock::time_point start = Clock::now();
+    ping(ogrid);
+    best = std::min(best, std::chrono::duration<double>(Clock::now() - start).count());
+  }
+  return best;
+}
+
+int main(int argc, char **argv)
+{
+  double sector = (argc > 1 ? std::atof(argv[1]) : 130) * CV_PI / 180;
+  double max_range = argc > 2 ? std::atof(argv[2]) : 40;
+  cv::Point2d where_sub(SIZE / 2 + 0.5, SIZE / 2 + 0.5);
+
+  FullCircleSweep sweep;
+  BeamRaycaster raycaster;
+  sweep.certainty = raycaster.certainty;
+  sweep.uncertainty = raycaster.uncertainty;
+  sweep.degrade = raycaster.degrade;
+  sweep.hit_buffer = raycaster.hit_buffer;
+
+  double before = per_ping([&](cv::Mat &ogrid) { sweep.zonify(ogrid, where_sub); });
+  double after = per_ping([&](cv::Mat &ogrid) {
+    raycaster.cast_fan(ogrid, where_sub, -sector / 2, sector / 2, 0.005, max_range / RESOLUTION);
+  });
+
+  std::printf("%dx%d ogrid at %.1f m, %.0f degree sector out to %.0f m\n", SIZE, SIZE, RESOLUTION,
+              sector * 180 / CV_PI, max_range);
+  std::printf("  full circle sweep  %8.3f ms per ping\n", 1e3 * before);
+  std::printf("  beam raycaster     %8.3f ms per ping\n", 1e3 * after);
+
+  // The same pings on a TiledOgrid, turning a little every ping, as OGridGen does with tiled_ogrid set
+  cv::Mat dense = make_ogrid();
+  TiledOgrid tiled(dense.size());
+  for (int y = 0; y < SIZE; ++y)
+    for (int x = 0; x < SIZE; ++x)
+      tiled.set(x, y, dense.at<int16_t>(y, x));
+  const int pings = 1000;
+  double tiled_time = 0;
+  for (int k = 0; k < pings; ++k)
+  {
+    double heading = 0.02 * k;
+    Clock::time_point start = Clock::now();
+    tiled.compact(raycaster.cast_fan(tiled, where_sub, heading - sector / 2, heading + sector / 2, 0.005,
+                                     max_range / RESOLUTION));
+    tiled_time += std::chrono::duration<double>(Clock::now() - start).count();
+  }
+  int tiles = ((SIZE + TiledOgrid::TILE - 1) / TiledOgrid::TILE) * ((SIZE + TiledOgrid::TILE - 1) / TiledOgrid::TILE);
+  std::printf("  tiled raycaster    %8.3f ms per ping, %zu of %d tiles expanded after %d pings, %.2f MB against "
+              "%.2f MB dense\n",
+              1e3 * tiled_time / pings, tiled.tiles_expanded(), tiles, pings, tiled.memory_bytes() / 1e6,
+              SIZE * SIZE * (sizeof(int16_t) + sizeof(uchar)) / 1e6);
+  return 0;
+}
@@ -0,0 +1,180 @@
+#include <gtest/gtest.h>
+
+#include <pcl/search/kdtree.h>
+#include <pcl/segmentation/extract_clusters.h>
+
+#include <algorithm>
+#include <map>
+#include <random>
+#include <vector>
+
+#include <IncrementalClusters.hpp>
+
+// A clustering as the sorted ids of each cluster's points, sorted, so two clusterings of the same points compare equal
+// whatever order they were found in. Each point's id is its intensity.
+typedef std::vector<std::vector<int>> Clustering;
+
+static const size_t MIN_SIZE = 3;
+static const size_t MAX_SIZE = 40;
+
+static Clustering incremental_clustering(IncrementalClusters &clusters)
+{
+  std::vector<IncrementalClusters::Cluster> found;
+  clusters.clusters(MIN_SIZE, MAX_SIZE, found);
+  Clustering clustering;
+  for (const IncrementalClusters::Cluster &cluster : found)
+  {
+    std::vector<int> ids;
+    for (const pcl::PointXYZI &p : cluster.points)
+      ids.push_back(p.intensity);
+    std::sort(ids.begin(), ids.end());
+    clustering.push_back(ids);
+  }
+  std::sort(clustering.begin(), clustering.end());
+  return clustering;
+}
+
+static Clustering pcl_clustering(const std::map<int, pcl::PointXYZI> &points, float tolerance)
+{
+  pcl::PointCloud<pcl::PointXYZI>::Ptr cloud(new pcl::PointCloud<pcl::PointXYZI>);
+  for (const auto &point : points)
+    cloud->points.push_back(point.second);
+  cloud->width = cloud->points.size();
+  cloud->height = 1;
+  Clustering clustering;
+  if (cloud->points.empty())
+    return clustering;
+
+  pcl::search::KdTree<pcl::PointXYZI>::Ptr tree(new pcl::search::KdTree<pcl::PointXYZI>);
+  tree->setInputCloud(cloud);
+  std::vector<pcl::PointIndices> cluster_indices;
+  pcl::EuclideanClusterExtraction<pcl::PointXYZI> ec;
+  ec.setClusterTolerance(tolerance);
+  ec.setMinClusterSize(MIN_SIZE);
+  ec.setMaxClusterSize(MAX_SIZE);
+  ec.setSearchMethod(tree);
+  ec.setInputCloud(cloud);
+  ec.extract(cluster_indices);
+
+  for (const pcl::PointIndices &indices : cluster_indices)
+  {
+    std::vector<int> ids;
+    for (int i : indices.indices)
+      ids.push_back(cloud->points[i].intensity);
+    std::sort(ids.begin(), ids.end());
+    clustering.push_back(ids);
+  }
+  std::sort(clustering.begin(), clustering.end());
+  return clustering;
+}
+
+// A seeded stream of adds, moves (small and large) and removes, checked against a from scratch clustering every few
+// steps, so merges, splits of dirty clusters and clusters leaving the size limits are all exercised
+TEST(IncrementalClusters, MatchesEuclideanClusterExtraction)
+{
+  std::mt19937 rng(42);
+  std::uniform_real_distribution<float> coordinate(0, 8);
+  std::uniform_real_distribution<float> nudge(-0.3, 0.3);
+  for (float tolerance : { 0.3f, 0.5f, 0.9f })
+  {
+    IncrementalClusters clusters(tolerance);
+    std::map<int, pcl::PointXYZI> points;
+    int next_id = 0;
+    for (int step = 0; step < 2000; ++step)
+    {
+      const int op = rng() % 10;
+      if (op < 5 || points.empty())
+      {
+        pcl::PointXYZI p;
+        p.x = coordinate(rng);
+        p.y = coordinate(rng);
+        p.z = coordinate(rng) / 4;
+        p.intensity = next_id;
+        points[next_id] = p;
+        clusters.update(next_id++, p);
+      }
+      else
+      {
+        auto it = points.begin();
+        std::advance(it, rng() % points.size());
+        if (op < 7)
+        {
+          clusters.remove(it->first);
+          points.erase(it);
+        }
+        else
+        {
+          pcl::PointXYZI &p = it->second;
+          if (op < 9)
+          {
+            p.x += nudge(rng);
+            p.y += nudge(rng);
+          }
+          else
+          {
+            p.x = coordinate(rng);
+            p.y = coordinate(rng);
+          }
+          clusters.update(it->first, p);
+        }
+      }
+      if (step % 50 == 49)
+      {
+        ASSERT_EQ(points.size(), clusters.size());
+        ASSERT_EQ(pcl_clustering(points, tolerance), incremental_clustering(clusters))
+            << "tolerance " << tolerance << ", step " << step;
+      }
+    }
+  }
+}
+
+TEST(IncrementalClusters, CentroidAndBoundsMatchPoints)
+{
+  IncrementalClusters clusters(1);
+  const float xs[] = { 0, 0.5, 1.2, 1.8 };
+  for (int i = 0; i < 4; ++i)
+  {
+    pcl::PointXYZI p;
+    p.x = xs[i];
+    p.y = 0.5f * (i % 2);
+    p.intensity = i;
+    clusters.update(i, p);
+  }
+  // Moving inwards leaves the box stale until the cluster is split, which removing a point causes
+  pcl::PointXYZI p;
+  p.x = 1;
+  p.intensity = 3;
+  clusters.update(3, p);
+  clusters.remove(0);
+
+  std::vector<IncrementalClusters::Cluster> found;
+  clusters.clusters(1, 10, found);
+  ASSERT_EQ(1u, found.size());
+  EXPECT_EQ(3u, found[0].points.size());
+  EXPECT_NEAR((0.5 + 1.2 + 1) / 3, found[0].centroid.x, 1e-5);
+  EXPECT_NEAR(0.5, found[0].min.x, 1e-6);
+  EXPECT_NEAR(1.2, found[0].max.x, 1e-6);
+  EXPECT_NEAR(0.5, found[0].max.y, 1e-6);
+}
+
+TEST(IncrementalClusters, ClearForgetsEveryPoint)
+{
+  IncrementalClusters clusters(1);
+  pcl::PointXYZI p;
+  clusters.update(0, p);
+  clusters.update(1, p);
+  clusters.clear();
+  EXPECT_EQ(0u, clusters.size());
+  std::vector<IncrementalClusters::Cluster> found;
+  clusters.clusters(1, 10, found);
+  EXPECT_TRUE(found.empty());
+  clusters.update(0, p);
+  clusters.clusters(1, 10, found);
+  EXPECT_EQ(1u, found.size());
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,161 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include <ObjectTracker.hpp>
+
+static IncrementalClusters::Cluster cluster_at(float x, float y = 0)
+{
+  IncrementalClusters::Cluster c;
+  c.centroid = pcl::PointXYZ(x, y, 0);
+  c.min = c.max = c.centroid;
+  c.points.resize(3);
+  return c;
+}
+
+static const ObjectTracker::Object *find_id(const ObjectTracker &tracker, uint32_t id)
+{
+  for (const ObjectTracker::Object &object : tracker.objects())
+  {
+    if (object.id == id)
+      return &object;
+  }
+  return nullptr;
+}
+
+TEST(ObjectTracker, UnmatchedClustersGetNewIds)
+{
+  ObjectTracker tracker(1, 0);
+  std::vector<IncrementalClusters::Cluster> clusters{ cluster_at(0), cluster_at(5) };
+  tracker.update(clusters, 1);
+  ASSERT_EQ(2u, tracker.objects().size());
+  EXPECT_EQ(0u, tracker.objects()[0].id);
+  EXPECT_EQ(1u, tracker.objects()[1].id);
+
+  // Both move within match_distance and a third appears
+  clusters = { cluster_at(5.3), cluster_at(0.2), cluster_at(10) };
+  tracker.update(clusters, 2);
+  ASSERT_EQ(3u, tracker.objects().size());
+  const ObjectTracker::Object *first = find_id(tracker, 0), *second = find_id(tracker, 1), *third = find_id(tracker, 2);
+  ASSERT_TRUE(first && second && third);
+  EXPECT_FLOAT_EQ(0.2, first->centroid.x);
+  EXPECT_EQ(1, first->first_seen);
+  EXPECT_EQ(2, first->last_seen);
+  EXPECT_FLOAT_EQ(5.3, second->centroid.x);
+  EXPECT_FLOAT_EQ(10, third->centroid.x);
+  EXPECT_EQ(2, third->first_seen);
+  // The points are taken from the cluster
+  EXPECT_EQ(3u, third->points.size());
+  EXPECT_TRUE(clusters[2].points.empty());
+}
+
+TEST(ObjectTracker, ClosestPairsMatchFirst)
+{
+  ObjectTracker tracker(1, 0);
+  std::vector<IncrementalClusters::Cluster> clusters{ cluster_at(0), cluster_at(1) };
+  tracker.update(clusters, 0);
+
+  // 0.45 is closer to id 0 than to id 1, but 0.05 is closer still, so 0.05 takes id 0 and 0.45 is left with id 1.
+  // Matching in the order of the clusters would have given 0.45 id 0 instead.
+  clusters = { cluster_at(0.45), cluster_at(0.05) };
+  tracker.update(clusters, 1);
+  ASSERT_EQ(2u, tracker.objects().size());
+  EXPECT_FLOAT_EQ(0.05, find_id(tracker, 0)->centroid.x);
+  EXPECT_FLOAT_EQ(0.45, find_id(tracker, 1)->centroid.x);
+
+  // Two clusters closest to the same object: the closer one keeps the id and the other is a new object
+  clusters = { cluster_at(0.5), cluster_at(0.15) };
+  ObjectTracker single(1, 0);
+  std::vector<IncrementalClusters::Cluster> one{ cluster_at(0) };
+  single.update(one, 0);
+  single.update(clusters, 1);
+  ASSERT_EQ(2u, single.objects().size());
+  EXPECT_FLOAT_EQ(0.15, find_id(single, 0)->centroid.x);
+  EXPECT_FLOAT_EQ(0.5, find_id(single, 1)->centroid.x);
+}
+
+TEST(ObjectTracker, NoMatchBeyondMatchDistance)
+{
+  ObjectTracker tracker(1, 0);
+  std::vector<IncrementalClusters::Cluster> clusters{ cluster_at(0) };
+  tracker.update(clusters, 0);
+  clusters = { cluster_at(0.8, 0.8) };
+  tracker.update(clusters, 1);
+  ASSERT_EQ(1u, tracker.objects().size());
+  EXPECT_EQ(1u, tracker.objects()[0].id);
+}
+
+TEST(ObjectTracker, MaxAgeZeroDropsUnseenObjectsRightAway)
+{
+  ObjectTracker tracker(1, 0);
+  std::vector<IncrementalClusters::Cluster> clusters{ cluster_at(0), cluster_at(5) };
+  tracker.update(clusters, 0);
+  clusters = { cluster_at(0.1) };
+  tracker.update(clusters, 0.3);
+  ASSERT_EQ(1u, tracker.objects().size());
+  EXPECT_EQ(0u, tracker.objects()[0].id);
+  clusters.clear();
+  tracker.update(clusters, 0.6);
+  EXPECT_TRUE(tracker.objects().empty());
+}
+
+TEST(ObjectTracker, MaxAgeKeepsUnseenObjectsUntilItPasses)
+{
+  ObjectTracker tracker(1, 5);
+  std::vector<IncrementalClusters::Cluster> clusters{ cluster_at(0) };
+  tracker.update(clusters, 0);
+  clusters.clear();
+  tracker.update(clusters, 4);
+  ASSERT_EQ(1u, tracker.objects().size());
+  EXPECT_EQ(0, tracker.objects()[0].last_seen);
+
+  // Seen again before it expired, it keeps its id and the age starts over
+  clusters = { cluster_at(0.2) };
+  tracker.update(clusters, 4.5);
+  ASSERT_EQ(1u, tracker.objects().size());
+  EXPECT_EQ(0u, tracker.objects()[0].id);
+  clusters.clear();
+  tracker.update(clusters, 9);
+  EXPECT_EQ(1u, tracker.objects().size());
+  tracker.update(clusters, 9.5);
+  EXPECT_TRUE(tracker.objects().empty());
+}
+
+// For ticks where the clusters didn't change, expire ages the objects as update would with the same clusters
+TEST(ObjectTracker, ExpireDropsOnlyUnseenObjects)
+{
+  ObjectTracker tracker(1, 5);
+  std::vector<IncrementalClusters::Cluster> clusters{ cluster_at(0), cluster_at(5) };
+  tracker.update(clusters, 0);
+  clusters = { cluster_at(0) };
+  tracker.update(clusters, 3);
+  EXPECT_FALSE(tracker.expire(4.9));
+  EXPECT_EQ(2u, tracker.objects().size());
+  EXPECT_TRUE(tracker.expire(5));
+  ASSERT_EQ(1u, tracker.objects().size());
+  EXPECT_EQ(0u, tracker.objects()[0].id);
+  EXPECT_TRUE(tracker.expire(8));
+  EXPECT_TRUE(tracker.objects().empty());
+  EXPECT_FALSE(tracker.expire(9));
+}
+
+TEST(ObjectTracker, ClearDoesNotReuseIds)
+{
+  ObjectTracker tracker(1, 0);
+  std::vector<IncrementalClusters::Cluster> clusters{ cluster_at(0), cluster_at(5) };
+  tracker.update(clusters, 0);
+  tracker.clear();
+  EXPECT_TRUE(tracker.objects().empty());
+
+  clusters = { cluster_at(0) };
+  tracker.update(clusters, 1);
+  ASSERT_EQ(1u, tracker.objects().size());
+  EXPECT_EQ(2u, tracker.objects()[0].id);
+  EXPECT_EQ(1, tracker.objects()[0].first_seen);
+}
+
+int main(int argc, char **argv)
+{
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}